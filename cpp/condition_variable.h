@@ -0,0 +1,102 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PBL_CPP_CONDITION_VARIABLE_H
+#define PBL_CPP_CONDITION_VARIABLE_H
+
+#include "version.h"
+
+#ifdef CPP11
+#include <condition_variable>
+#else
+#include "mutex.h"
+
+#ifdef POSIX_THREADS
+namespace cpp11
+{
+/** Wait for a condition while holding a cpp11::mutex
+ */
+class condition_variable
+{
+public:
+	typedef ::pbl::os::condition_variable_type* native_handle_type;
+
+	condition_variable()
+	{
+		::pthread_cond_init(&c, 0);
+	}
+
+	~condition_variable()
+	{
+		::pthread_cond_destroy(&c);
+	}
+
+	void notify_one()
+	{
+		::pthread_cond_signal(&c);
+	}
+
+	void notify_all()
+	{
+		::pthread_cond_broadcast(&c);
+	}
+
+	void wait(unique_lock< mutex >& lock)
+	{
+		::pthread_cond_wait( &c, lock.mutex()->native_handle() );
+	}
+
+	template< class Predicate >
+	void wait(
+		unique_lock< mutex >& lock,
+		Predicate             pred
+	)
+	{
+		while ( !pred() )
+		{
+			wait(lock);
+		}
+	}
+
+	native_handle_type native_handle()
+	{
+		return &c;
+	}
+private:
+	// non-copyable
+	condition_variable(const condition_variable&);
+	condition_variable& operator=(const condition_variable&);
+
+	::pbl::os::condition_variable_type c;
+};
+
+}
+#endif // ifdef POSIX_THREADS
+#endif // ifdef CPP11
+
+#endif // PBL_CPP_CONDITION_VARIABLE_H
@@ -44,6 +44,9 @@ HEADERS += \
     fs/remove.h \
     fs/tempdir.h \
     config/os.h \
+    mutex.h \
+    condition_variable.h \
+    thread.h \
     cstdlib.h
 unix {
     target.path = /usr/lib
@@ -33,43 +33,115 @@
 #include <climits>
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined( __linux__ )
+#include <sys/syscall.h>
+#if defined( SYS_getdents64 ) && defined( O_DIRECTORY )
+#define PBL_CPP_FS_GETDENTS
+#endif
+#endif
 
 #include "direntry.h"
 #include "path.h"
 
+namespace
+{
+bool is_dot_or_dotdot(const char* s)
+{
+	return s[0] == '.' && ( s[1] == '\0' || ( s[1] == '.' && s[2] == '\0' ) );
+}
+
+cpp17::filesystem::file_type convert_type(unsigned char t)
+{
+	switch ( t )
+	{
+	case DT_FIFO:
+
+		return file_type::fifo;
+
+	case DT_CHR:
+
+		return file_type::character;
+
+	case DT_DIR:
+
+		return file_type::directory;
+
+	case DT_BLK:
+
+		return file_type::block;
+
+	case DT_REG:
+
+		return file_type::regular;
+
+	case DT_LNK:
+
+		return file_type::symlink;
+
+	case DT_SOCK:
+
+		return file_type::socket;
+
+	default:
+		break;
+	}       // switch
+
+	return file_type::unknown;
+}
+
+#ifdef PBL_CPP_FS_GETDENTS
+/// Layout of the records returned by getdents64
+struct linux_dirent64
+{
+	unsigned long long d_ino;
+	long long          d_off;
+	unsigned short     d_reclen;
+	unsigned char      d_type;
+	char               d_name[1];
+};
+
+/// Size of the buffer that entries are read into, a batch at a time
+const std::size_t getdents_buffer = 64 * 1024;
+#endif
+}
+
 namespace cpp17
 {
 namespace filesystem
 {
+#ifdef PBL_CPP_FS_GETDENTS
 
-/// @todo Could save the malloc/free (of e) if we mark end-of-directory
+/** Reads entries with getdents64, many at a time, into a buffer that is
+ * reused for the whole directory
+ */
 class directory_iterator::impl
 {
 public:
 	impl()
-		: p(), d(0), e(0), info(), valid_info(false)
+		: p(), fd(-1), owns_fd(false), buf(0), pos(0), len(0), e(0), info(), valid_info(false)
 	{
 	}
 
 	explicit impl(const path& path_)
-		: p(path_), d(0), e(0), info(), valid_info(false)
+		: p(path_), fd(-1), owns_fd(true), buf(0), pos(0), len(0), e(0), info(), valid_info(false)
 	{
-		d = ::opendir( path_.c_str() );
+		fd = ::open(path_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-		if ( d )
-		{
-			e = acquire();
-			next();
-		}
+		start();
+	}
+
+	explicit impl(int dirfd)
+		: p(), fd(dirfd), owns_fd(false), buf(0), pos(0), len(0), e(0), info(), valid_info(false)
+	{
+		start();
 	}
 
 	~impl()
 	{
-		if ( d )
-		{
-			release();
-			::closedir(d);
-		}
+		release();
 	}
 
 	/** Test if this is an end iterator
@@ -81,25 +153,32 @@ public:
 
 	bool next()
 	{
-		if ( d )
+		if ( fd != -1 )
 		{
 			valid_info = false;
 
 			do
 			{
-				dirent* ptr = 0;
+				if ( pos >= len )
+				{
+					const long n = ::syscall(SYS_getdents64, fd, buf, getdents_buffer);
 
-				const int res = ::readdir_r(d, e, &ptr);
+					if ( n <= 0 )
+					{
+						// error, or end of directory
+						release();
 
-				if ( res != 0 || ptr == 0 )
-				{
-					// error, or end of directory
-					release();
+						return false;
+					}
 
-					return false;
+					pos = 0;
+					len = static_cast< std::size_t >( n );
 				}
+
+				e    = reinterpret_cast< const linux_dirent64* >( buf + pos );
+				pos += e->d_reclen;
 			}
-			while ( std::strcmp(e->d_name, ".") == 0 || std::strcmp(e->d_name, "..") == 0 );
+			while ( is_dot_or_dotdot(e->d_name) );
 
 			return true;
 		}
@@ -107,52 +186,192 @@ public:
 		return false;
 	}
 
-	path get_path() const
+	const char* name() const
 	{
-		return e ? ( p / e->d_name ) : path();
+		return e ? e->d_name : "";
 	}
 
 	file_type type() const
 	{
-		if ( e )
+		return e ? convert_type(e->d_type) : file_type::unknown;
+	}
+
+	const directory_entry& get_reference()
+	{
+		update();
+
+		return info;
+	}
+
+	const directory_entry* get_pointer()
+	{
+		update();
+
+		return &info;
+	}
+
+private:
+	void update()
+	{
+		if ( !valid_info && e )
+		{
+			info.assign(p / e->d_name);
+			valid_info = true;
+		}
+	}
+
+	void start()
+	{
+		if ( fd != -1 )
 		{
-			switch ( e->d_type )
+			if ( !owns_fd )
 			{
-			case DT_FIFO:
+				// Start from the first entry, even if the caller read some already
+				::lseek(fd, 0, SEEK_SET);
+			}
 
-				return file_type::fifo;
+			buf = static_cast< char* >( ::malloc(getdents_buffer) );
 
-			case DT_CHR:
+			if ( buf )
+			{
+				next();
+			}
+			else
+			{
+				release();
+			}
+		}
+	}
 
-				return file_type::character;
+	void release()
+	{
+		if ( fd != -1 )
+		{
+			if ( owns_fd )
+			{
+				::close(fd);
+			}
 
-			case DT_DIR:
+			fd = -1;
+		}
+
+		::free(buf);
+		buf = 0;
+		e   = 0;
+	}
+
+	// Path to directory
+	path p;
+
+	/// Open directory
+	int fd;
+
+	/// Close fd when done
+	bool owns_fd;
+
+	/// Entries from the last getdents64 call
+	char*       buf;
+	std::size_t pos;
+	std::size_t len;
+
+	/// Current entry, in buf
+	const linux_dirent64* e;
+
+	directory_entry info;
 
-				return file_type::directory;
+	bool valid_info; // info has been populated
+};
 
-			case DT_BLK:
+#else // ifdef PBL_CPP_FS_GETDENTS
 
-				return file_type::block;
+/// @todo Could save the malloc/free (of e) if we mark end-of-directory
+class directory_iterator::impl
+{
+public:
+	impl()
+		: p(), d(0), e(0), info(), valid_info(false)
+	{
+	}
 
-			case DT_REG:
+	explicit impl(const path& path_)
+		: p(path_), d(0), e(0), info(), valid_info(false)
+	{
+		d = ::opendir( path_.c_str() );
+
+		start();
+	}
+
+	explicit impl(int dirfd)
+		: p(), d(0), e(0), info(), valid_info(false)
+	{
+		// A new open file description, so the caller's stays where it is
+		const int fd = ::openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+		if ( fd != -1 )
+		{
+			d = ::fdopendir(fd);
+
+			if ( !d )
+			{
+				::close(fd);
+			}
+		}
+
+		start();
+	}
+
+	~impl()
+	{
+		if ( d )
+		{
+			release();
+			::closedir(d);
+		}
+	}
 
-				return file_type::regular;
+	/** Test if this is an end iterator
+	 */
+	bool is_end() const
+	{
+		return !e;
+	}
 
-			case DT_LNK:
+	bool next()
+	{
+		if ( d )
+		{
+			valid_info = false;
 
-				return file_type::symlink;
+			do
+			{
+				dirent* ptr = 0;
 
-			case DT_SOCK:
+				const int res = ::readdir_r(d, e, &ptr);
 
-				return file_type::socket;
+				if ( res != 0 || ptr == 0 )
+				{
+					// error, or end of directory
+					release();
 
-			default:
-				break;
-			}       // switch
+					return false;
+				}
+			}
+			while ( is_dot_or_dotdot(e->d_name) );
 
+			return true;
 		}
 
-		return file_type::unknown;
+		return false;
+	}
+
+	const char* name() const
+	{
+		return e ? e->d_name : "";
+	}
+
+	file_type type() const
+	{
+		return e ? convert_type(e->d_type) : file_type::unknown;
 	}
 
 	const directory_entry& get_reference()
@@ -181,6 +400,15 @@ private:
 		}
 	}
 
+	void start()
+	{
+		if ( d )
+		{
+			e = acquire();
+			next();
+		}
+	}
+
 	static dirent* acquire()
 	{
 		/* dirent::d_name is required to be at least NAME_MAX + 1 bytes.
@@ -217,6 +445,8 @@ private:
 	bool valid_info; // info has been populated
 };
 
+#endif // ifdef PBL_CPP_FS_GETDENTS
+
 directory_iterator::directory_iterator()
 	: pimpl(new impl)
 {
@@ -227,6 +457,11 @@ directory_iterator::directory_iterator(const path& path_)
 {
 }
 
+directory_iterator::directory_iterator(int dirfd)
+	: pimpl( new impl(dirfd) )
+{
+}
+
 directory_iterator::~directory_iterator()
 {
 	delete pimpl;
@@ -266,6 +501,11 @@ file_type directory_iterator::type() const
 	return pimpl->type();
 }
 
+const char* directory_iterator::name() const
+{
+	return pimpl->name();
+}
+
 void directory_iterator::swap(directory_iterator& d)
 {
 	std::swap(pimpl, d.pimpl);
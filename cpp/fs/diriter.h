@@ -63,6 +63,16 @@ public:
 	 */
 	explicit directory_iterator(const path& path_);
 
+	/** Construct an iterator for a directory that is already open
+	 *
+	 * The descriptor is not closed by the iterator, and must stay open while
+	 * iterating. The paths of the entries are just their names, relative
+	 * to the directory.
+	 *
+	 * @note Not part of std::filesystem
+	 */
+	explicit directory_iterator(int dirfd);
+
 	/** Construct an end iterator
 	 */
 	directory_iterator();
@@ -101,8 +111,19 @@ public:
 	 */
 	const directory_entry* operator->() const;
 
+	/** Get the type of the file system object, without a stat
+	 *
+	 * Comes from the directory entry itself. May be file_type::unknown, if
+	 * the file system does not record types in directories.
+	 */
 	file_type type() const;
 
+	/** Get the name of the file system object, without allocating
+	 *
+	 * The pointer is valid until the iterator is incremented or destroyed.
+	 */
+	const char* name() const;
+
 	void swap(directory_iterator&);
 private:
 	class impl;
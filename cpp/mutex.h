@@ -0,0 +1,168 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PBL_CPP_MUTEX_H
+#define PBL_CPP_MUTEX_H
+
+#include "version.h"
+
+#ifdef CPP11
+#include <mutex>
+#else
+#include "config/os.h"
+
+#ifdef POSIX_THREADS
+namespace cpp11
+{
+/** A non-recursive mutex
+ */
+class mutex
+{
+public:
+	typedef ::pbl::os::mutex_type* native_handle_type;
+
+	mutex()
+	{
+		::pthread_mutex_init(&m, 0);
+	}
+
+	~mutex()
+	{
+		::pthread_mutex_destroy(&m);
+	}
+
+	void lock()
+	{
+		::pthread_mutex_lock(&m);
+	}
+
+	bool try_lock()
+	{
+		return ::pthread_mutex_trylock(&m) == 0;
+	}
+
+	void unlock()
+	{
+		::pthread_mutex_unlock(&m);
+	}
+
+	native_handle_type native_handle()
+	{
+		return &m;
+	}
+private:
+	// non-copyable
+	mutex(const mutex&);
+	mutex& operator=(const mutex&);
+
+	::pbl::os::mutex_type m;
+};
+
+/** Lock a mutex for the lifetime of this object
+ */
+template< class Mutex >
+class lock_guard
+{
+public:
+	typedef Mutex mutex_type;
+
+	explicit lock_guard(mutex_type& m_)
+		: m(m_)
+	{
+		m.lock();
+	}
+
+	~lock_guard()
+	{
+		m.unlock();
+	}
+private:
+	// non-copyable
+	lock_guard(const lock_guard&);
+	lock_guard& operator=(const lock_guard&);
+
+	mutex_type& m;
+};
+
+/** A lock that can be released and reacquired (ex., by a condition variable)
+ */
+template< class Mutex >
+class unique_lock
+{
+public:
+	typedef Mutex mutex_type;
+
+	explicit unique_lock(mutex_type& m_)
+		: m(&m_), owns(false)
+	{
+		lock();
+	}
+
+	~unique_lock()
+	{
+		if ( owns )
+		{
+			m->unlock();
+		}
+	}
+
+	void lock()
+	{
+		m->lock();
+		owns = true;
+	}
+
+	void unlock()
+	{
+		m->unlock();
+		owns = false;
+	}
+
+	bool owns_lock() const
+	{
+		return owns;
+	}
+
+	mutex_type* mutex() const
+	{
+		return m;
+	}
+private:
+	// non-copyable
+	unique_lock(const unique_lock&);
+	unique_lock& operator=(const unique_lock&);
+
+	mutex_type* m;
+	bool        owns;
+};
+
+}
+#endif // ifdef POSIX_THREADS
+#endif // ifdef CPP11
+
+#endif // PBL_CPP_MUTEX_H
@@ -0,0 +1,157 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PBL_CPP_THREAD_H
+#define PBL_CPP_THREAD_H
+
+#include "version.h"
+
+#ifdef CPP11
+#include <thread>
+#else
+#include <exception>
+
+#include "config/os.h"
+
+#ifdef POSIX_THREADS
+namespace cpp11
+{
+/** A thread of execution
+ *
+ * @note Only the single argument constructor, f(a), is supported
+ */
+class thread
+{
+public:
+	thread()
+		: t(), running(false)
+	{
+	}
+
+	template< class F, class A >
+	thread(
+		F f,
+		A a
+	)
+		: t(), running(false)
+	{
+		starter< F, A >* s = new starter< F, A >(f, a);
+
+		if ( ::pthread_create(&t, 0, &starter< F, A >::run, s) == 0 )
+		{
+			running = true;
+		}
+		else
+		{
+			delete s;
+		}
+	}
+
+	~thread()
+	{
+		if ( running )
+		{
+			std::terminate();
+		}
+	}
+
+	bool joinable() const
+	{
+		return running;
+	}
+
+	void join()
+	{
+		if ( running )
+		{
+			::pthread_join(t, 0);
+			running = false;
+		}
+	}
+
+	void detach()
+	{
+		if ( running )
+		{
+			::pthread_detach(t);
+			running = false;
+		}
+	}
+
+	static unsigned hardware_concurrency()
+	{
+		#ifdef _SC_NPROCESSORS_ONLN
+		const long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+
+		return n > 0 ? static_cast< unsigned >( n ) : 0;
+
+		#else
+
+		return 0;
+
+		#endif
+	}
+private:
+	template< class F, class A >
+	struct starter
+	{
+		starter(
+			F f_,
+			A a_
+		)
+			: f(f_), a(a_)
+		{
+		}
+
+		static void* run(void* p)
+		{
+			starter* s = static_cast< starter* >( p );
+
+			s->f(s->a);
+			delete s;
+
+			return 0;
+		}
+
+		F f;
+		A a;
+	};
+
+	// non-copyable
+	thread(const thread&);
+	thread& operator=(const thread&);
+
+	::pbl::os::thread_type t;
+	bool                   running;
+};
+
+}
+#endif // ifdef POSIX_THREADS
+#endif // ifdef CPP11
+
+#endif // PBL_CPP_THREAD_H
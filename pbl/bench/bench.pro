@@ -0,0 +1,12 @@
+#-------------------------------------------------
+#
+# Benchmarks for the pbl library. Not built by default:
+#   qmake pbl/bench/bench.pro && make
+#
+#-------------------------------------------------
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    memdiff_bench.pro \
+    scan_bench.pro
@@ -0,0 +1,156 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* Measures how fast blocks are compared: std::memcmp, first_difference, and
+ * the two together, as compare.cpp uses them.
+ *
+ * Build with bench.pro, or:
+ *   g++ -O2 -I. pbl/bench/memdiff_bench.cpp pbl/fileutil/memdiff.cpp
+ *
+ * Usage: memdiff_bench [block size in KiB] [total MiB]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include "pbl/fileutil/memdiff.h"
+
+namespace
+{
+/// Bytes compared, so the compiler can't drop the comparisons
+volatile std::size_t sink = 0;
+
+double seconds()
+{
+	return static_cast< double >( std::clock() ) / CLOCKS_PER_SEC;
+}
+
+std::size_t by_memcmp(
+	const char* a,
+	const char* b,
+	std::size_t n
+)
+{
+	return std::memcmp(a, b, n) == 0 ? n : 0;
+}
+
+std::size_t by_first_difference(
+	const char* a,
+	const char* b,
+	std::size_t n
+)
+{
+	return pbl::fs::first_difference(a, b, n);
+}
+
+std::size_t by_both(
+	const char* a,
+	const char* b,
+	std::size_t n
+)
+{
+	return std::memcmp(a, b, n) == 0 ? n : pbl::fs::first_difference(a, b, n);
+}
+
+typedef std::size_t (* method_type)(const char*, const char*, std::size_t);
+
+/** Compare the blocks over and over
+ * @returns microseconds per MiB
+ */
+double run(
+	method_type        method,
+	const char*        a,
+	const char*        b,
+	std::size_t        block,
+	unsigned long long total
+)
+{
+	const unsigned long long reps  = total / block;
+	const double             start = seconds();
+
+	for ( unsigned long long i = 0; i < reps; ++i )
+	{
+		sink = sink + method(a, b, block);
+	}
+
+	const double elapsed = seconds() - start;
+
+	return elapsed * 1e6 / ( static_cast< double >( reps * block ) / ( 1024 * 1024 ) );
+}
+
+}
+
+int main(
+	int    argc,
+	char** argv
+)
+{
+	const std::size_t        block = ( argc > 1 ? std::strtoul(argv[1], 0, 10) : 1024 ) * 1024;
+	const unsigned long long total = ( argc > 2 ? std::strtoull(argv[2], 0, 10) : 4096 ) * 1024 * 1024;
+
+	if ( block == 0 || total < block )
+	{
+		std::fprintf(stderr, "usage: %s [block size in KiB] [total MiB]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	std::vector< char > a(block);
+	std::vector< char > b(block);
+
+	for ( std::size_t i = 0; i < block; ++i )
+	{
+		a[i] = static_cast< char >( std::rand() );
+	}
+
+	b = a;
+
+	const char* const names[] = { "memcmp", "first_difference", "memcmp then first_difference" };
+	const method_type methods[] = { by_memcmp, by_first_difference, by_both };
+
+	std::printf("%lu KiB blocks, us/MiB\n", static_cast< unsigned long >( block / 1024 ) );
+	std::printf("%-30s %10s %10s\n", "", "equal", "differ");
+
+	for ( std::size_t m = 0; m < sizeof( methods ) / sizeof( methods[0] ); ++m )
+	{
+		b[block - 1] = a[block - 1];
+
+		const double equal = run(methods[m], &a[0], &b[0], block, total);
+
+		// Worst case: the difference is at the very end
+		b[block - 1] = static_cast< char >( ~a[block - 1] );
+
+		const double differ = run(methods[m], &a[0], &b[0], block, total);
+
+		std::printf("%-30s %10.1f %10.1f\n", names[m], equal, differ);
+	}
+
+	return EXIT_SUCCESS;
+}
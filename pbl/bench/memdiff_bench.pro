@@ -0,0 +1,21 @@
+#-------------------------------------------------
+#
+# memdiff_bench: built by bench.pro
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = memdiff_bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+QMAKE_CXXFLAGS = -pipe
+QMAKE_CXXFLAGS_RELEASE = -O2
+
+SOURCES += \
+    memdiff_bench.cpp \
+    ../fileutil/memdiff.cpp
+
+INCLUDEPATH += $$PWD/../..
@@ -0,0 +1,283 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/* Measures how fast a directory tree is read: the way it used to be, with
+ * readdir and a stat of every entry by its full path, against getdents64
+ * with the type from each entry and subdirectories opened with openat. The
+ * whole scanner, with its threads, is timed too.
+ *
+ * Build with bench.pro.
+ *
+ * Usage: scan_bench directory [depth] [passes]
+ *
+ * Symlinks to directories are followed, as the scanner follows them, so the
+ * depth limit keeps a link cycle from being read forever.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "cpp/filesystem.h"
+#include "pbl/fileutil/directorycontents.h"
+
+namespace
+{
+/// What one pass did
+struct counts
+{
+	unsigned long dirs;
+	unsigned long files;
+	unsigned long stats;
+};
+
+double seconds()
+{
+	struct timeval tv;
+
+	::gettimeofday(&tv, 0);
+
+	return static_cast< double >( tv.tv_sec ) + static_cast< double >( tv.tv_usec ) / 1e6;
+}
+
+bool is_hidden(const char* name)
+{
+	return name[0] == '.';
+}
+
+/** Read a tree as the scanner used to: readdir, then stat each entry by its
+ * full path to find its type
+ */
+void scan_readdir(
+	const std::string& path,
+	int                depth,
+	counts&            c
+)
+{
+	DIR* d = ::opendir( path.c_str() );
+
+	if ( !d )
+	{
+		return;
+	}
+
+	++c.dirs;
+
+	while ( struct dirent* e = ::readdir(d) )
+	{
+		if ( is_hidden(e->d_name) )
+		{
+			continue;
+		}
+
+		const std::string p = path + "/" + e->d_name;
+		struct stat       st;
+
+		++c.stats;
+
+		if ( ::stat(p.c_str(), &st) == 0 )
+		{
+			if ( S_ISDIR(st.st_mode) )
+			{
+				if ( depth > 1 )
+				{
+					scan_readdir(p, depth - 1, c);
+				}
+			}
+			else if ( S_ISREG(st.st_mode) )
+			{
+				++c.files;
+			}
+		}
+	}
+
+	::closedir(d);
+}
+
+/** Read a tree as the scanner does now: getdents64 through
+ * directory_iterator, the type from the entry, and openat for
+ * subdirectories. Only entries of unknown type, and symlinks, are stat-ed
+ */
+void scan_getdents(
+	int     fd,
+	int     depth,
+	counts& c
+)
+{
+	++c.dirs;
+
+	for ( cpp::filesystem::directory_iterator it(fd), last; it != last; ++it )
+	{
+		if ( is_hidden( it.name() ) )
+		{
+			continue;
+		}
+
+		cpp::filesystem::file_type t = it.type();
+
+		if ( t == file_type::unknown || t == file_type::symlink )
+		{
+			struct stat st;
+
+			++c.stats;
+
+			if ( ::fstatat(fd, it.name(), &st, 0) != 0 )
+			{
+				continue;
+			}
+
+			t = S_ISDIR(st.st_mode) ? file_type::directory
+			    : ( S_ISREG(st.st_mode) ? file_type::regular : file_type::unknown );
+		}
+
+		if ( t == file_type::directory && depth > 1 )
+		{
+			const int sub = ::openat(fd, it.name(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+			if ( sub != -1 )
+			{
+				scan_getdents(sub, depth - 1, c);
+				::close(sub);
+			}
+		}
+		else if ( t == file_type::regular )
+		{
+			++c.files;
+		}
+	}
+}
+
+void report(
+	const char*   name,
+	const counts& c,
+	double        elapsed,
+	unsigned      passes
+)
+{
+	std::printf("%-28s %10.2f %8lu %8lu %10lu\n", name, elapsed * 1000 / passes, c.dirs / passes, c.files / passes, c.stats / passes);
+}
+
+}
+
+int main(
+	int    argc,
+	char** argv
+)
+{
+	if ( argc < 2 )
+	{
+		std::fprintf(stderr, "usage: %s directory [depth] [passes]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	char* const resolved = ::realpath(argv[1], 0);
+
+	if ( !resolved )
+	{
+		std::perror(argv[1]);
+
+		return EXIT_FAILURE;
+	}
+
+	// The scanner wants an absolute path
+	const std::string root = resolved;
+
+	std::free(resolved);
+
+	const int      depth  = argc > 2 ? std::atoi(argv[2]) : 10;
+	const unsigned passes = argc > 3 ? static_cast< unsigned >( std::strtoul(argv[3], 0, 10) ) : 10;
+
+	if ( depth <= 0 || passes == 0 )
+	{
+		std::fprintf(stderr, "usage: %s directory [depth] [passes]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	// Warm the cache, so every method reads from memory
+	{
+		counts c = { 0, 0, 0 };
+
+		scan_readdir(root, depth, c);
+	}
+
+	std::printf("%-28s %10s %8s %8s %10s\n", "per pass", "ms", "dirs", "files", "stats");
+
+	{
+		counts       c     = { 0, 0, 0 };
+		const double start = seconds();
+
+		for ( unsigned i = 0; i < passes; ++i )
+		{
+			scan_readdir(root, depth, c);
+		}
+
+		report("readdir + stat", c, seconds() - start, passes);
+	}
+
+	{
+		counts       c     = { 0, 0, 0 };
+		const double start = seconds();
+
+		for ( unsigned i = 0; i < passes; ++i )
+		{
+			const int fd = ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+			if ( fd != -1 )
+			{
+				scan_getdents(fd, depth, c);
+				::close(fd);
+			}
+		}
+
+		report("getdents64 + openat", c, seconds() - start, passes);
+	}
+
+	{
+		const double start = seconds();
+
+		for ( unsigned i = 0; i < passes; ++i )
+		{
+			DirectoryContents t;
+
+			t.change_root(root, depth);
+		}
+
+		const double elapsed = seconds() - start;
+
+		std::printf("%-28s %10.2f\n", "DirectoryContents (threads)", elapsed * 1000 / passes);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+#-------------------------------------------------
+#
+# scan_bench: built by bench.pro
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = scan_bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+QMAKE_CXXFLAGS = -pipe
+QMAKE_CXXFLAGS_RELEASE = -O2
+
+SOURCES += \
+    scan_bench.cpp \
+    ../fileutil/directorycontents.cpp \
+    ../fileutil/ignorerules.cpp \
+    ../fileutil/hashcache.cpp \
+    ../fileutil/contenthash.cpp \
+    ../util/strings.cpp \
+    ../../cpp/fs/absolute.cpp \
+    ../../cpp/fs/basename.cpp \
+    ../../cpp/fs/cleanpath.cpp \
+    ../../cpp/fs/copyfile.cpp \
+    ../../cpp/fs/create_directory.cpp \
+    ../../cpp/fs/current_path.cpp \
+    ../../cpp/fs/direntry.cpp \
+    ../../cpp/fs/diriter.cpp \
+    ../../cpp/fs/filestatus.cpp \
+    ../../cpp/fs/filetype.cpp \
+    ../../cpp/fs/path.cpp \
+    ../../cpp/fs/perms.cpp \
+    ../../cpp/fs/remove.cpp \
+    ../../cpp/fs/tempdir.cpp
+
+INCLUDEPATH += $$PWD/../..
+
+LIBS += -lpthread
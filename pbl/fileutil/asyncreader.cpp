@@ -0,0 +1,495 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "asyncreader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "cpp/condition_variable.h"
+#include "cpp/mutex.h"
+#include "cpp/thread.h"
+
+#include "pbl/config/os.h"
+
+#ifdef OS_POSIX
+#include <sys/types.h>
+#endif
+
+#if defined( __linux__ )
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 1, 0)
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#if defined( __NR_io_uring_setup ) && defined( __NR_io_uring_enter )
+#define PBL_FS_IO_URING
+#endif
+#endif
+#endif
+
+namespace
+{
+using pbl::fs::AsyncReader;
+
+/// Most threads used by the fallback reader
+const unsigned max_reader_threads = 32;
+
+/** Read the whole request, or until end of file
+ * @returns The number of bytes read, or -errno
+ */
+long read_request(const AsyncReader::request& r)
+{
+	std::size_t n = 0;
+
+	while ( n < r.length )
+	{
+		const ssize_t k = ::pread(r.fd, r.buffer + n, r.length - n, static_cast< off_t >( r.offset + static_cast< long long >( n ) ) );
+
+		if ( k < 0 )
+		{
+			if ( errno != EINTR )
+			{
+				return -errno;
+			}
+		}
+		else if ( k == 0 )
+		{
+			break;
+		}
+		else
+		{
+			n += static_cast< std::size_t >( k );
+		}
+	}
+
+	return static_cast< long >( n );
+}
+
+/** Reads with a pool of threads, each calling pread
+ */
+class threaded_reader
+	: public AsyncReader
+{
+public:
+	explicit threaded_reader(unsigned nthreads)
+		: stopping(false)
+	{
+		for ( unsigned i = 0; i < nthreads; ++i )
+		{
+			workers.push_back( new cpp::thread(&threaded_reader::work, this) );
+		}
+	}
+
+	~threaded_reader()
+	{
+		{
+			cpp::lock_guard< cpp::mutex > lock(m);
+			stopping = true;
+		}
+
+		queued.notify_all();
+
+		for ( std::size_t i = 0; i < workers.size(); ++i )
+		{
+			workers[i]->join();
+			delete workers[i];
+		}
+	}
+
+	bool submit(request& r)
+	{
+		cpp::lock_guard< cpp::mutex > lock(m);
+
+		r.done = false;
+		pending.push_back(&r);
+		queued.notify_one();
+
+		return true;
+	}
+
+	void wait(request& r)
+	{
+		cpp::unique_lock< cpp::mutex > lock(m);
+
+		while ( !r.done )
+		{
+			completed.wait(lock);
+		}
+	}
+private:
+	static void work(threaded_reader* self)
+	{
+		self->run();
+	}
+
+	void run()
+	{
+		cpp::unique_lock< cpp::mutex > lock(m);
+
+		while ( true )
+		{
+			while ( !stopping && pending.empty() )
+			{
+				queued.wait(lock);
+			}
+
+			if ( stopping )
+			{
+				return;
+			}
+
+			request* r = pending.front();
+			pending.pop_front();
+
+			lock.unlock();
+			const long res = read_request(*r);
+			lock.lock();
+
+			r->result = res;
+			r->done   = true;
+			completed.notify_all();
+		}
+	}
+
+	cpp::mutex                   m;
+	cpp::condition_variable      queued;
+	cpp::condition_variable      completed;
+	std::deque< request* >       pending;
+	std::vector< cpp::thread* >  workers;
+	bool                         stopping;
+};
+
+#ifdef PBL_FS_IO_URING
+int io_uring_setup(
+	unsigned         entries,
+	io_uring_params* p
+)
+{
+	return static_cast< int >( ::syscall(__NR_io_uring_setup, entries, p) );
+}
+
+int io_uring_enter(
+	int      fd,
+	unsigned to_submit,
+	unsigned min_complete,
+	unsigned flags
+)
+{
+	return static_cast< int >( ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0) );
+}
+
+/** Reads with a Linux io_uring
+ *
+ * Requests are submitted as soon as they are made. Whichever thread is
+ * waiting first reaps completions for everyone; the others wait for it.
+ */
+class uring_reader
+	: public AsyncReader
+{
+public:
+	uring_reader()
+		: ring(-1), sq_ptr(MAP_FAILED), sq_size(0), cq_ptr(MAP_FAILED), cq_size(0),
+		sqes(static_cast< io_uring_sqe* >( MAP_FAILED ) ), sqes_size(0),
+		sq_head(0), sq_tail(0), sq_mask(0), sq_array(0),
+		cq_head(0), cq_tail(0), cq_mask(0), cqes(0), reaping(false)
+	{
+	}
+
+	~uring_reader()
+	{
+		if ( sqes != MAP_FAILED )
+		{
+			::munmap(sqes, sqes_size);
+		}
+
+		if ( cq_ptr != MAP_FAILED && cq_ptr != sq_ptr )
+		{
+			::munmap(cq_ptr, cq_size);
+		}
+
+		if ( sq_ptr != MAP_FAILED )
+		{
+			::munmap(sq_ptr, sq_size);
+		}
+
+		if ( ring != -1 )
+		{
+			::close(ring);
+		}
+	}
+
+	/** Set up the ring
+	 * @returns false if io_uring is not available (ex., old kernel, or
+	 * disabled by policy)
+	 */
+	bool init(unsigned depth)
+	{
+		io_uring_params p;
+
+		std::memset(&p, 0, sizeof( p ) );
+
+		ring = io_uring_setup(depth, &p);
+
+		if ( ring < 0 )
+		{
+			ring = -1;
+
+			return false;
+		}
+
+		sq_size = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+		cq_size = p.cq_off.cqes + p.cq_entries * sizeof( io_uring_cqe );
+
+		const bool single_mmap = ( p.features & IORING_FEAT_SINGLE_MMAP ) != 0;
+
+		if ( single_mmap )
+		{
+			sq_size = cq_size = std::max(sq_size, cq_size);
+		}
+
+		sq_ptr = ::mmap(0, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+
+		if ( sq_ptr == MAP_FAILED )
+		{
+			return false;
+		}
+
+		cq_ptr = single_mmap ? sq_ptr : ::mmap(0, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+
+		if ( cq_ptr == MAP_FAILED )
+		{
+			return false;
+		}
+
+		sqes_size = p.sq_entries * sizeof( io_uring_sqe );
+		sqes      = static_cast< io_uring_sqe* >( ::mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES) );
+
+		if ( sqes == MAP_FAILED )
+		{
+			return false;
+		}
+
+		char* sq = static_cast< char* >( sq_ptr );
+		char* cq = static_cast< char* >( cq_ptr );
+
+		sq_head  = reinterpret_cast< unsigned* >( sq + p.sq_off.head );
+		sq_tail  = reinterpret_cast< unsigned* >( sq + p.sq_off.tail );
+		sq_mask  = *reinterpret_cast< unsigned* >( sq + p.sq_off.ring_mask );
+		sq_array = reinterpret_cast< unsigned* >( sq + p.sq_off.array );
+		cq_head  = reinterpret_cast< unsigned* >( cq + p.cq_off.head );
+		cq_tail  = reinterpret_cast< unsigned* >( cq + p.cq_off.tail );
+		cq_mask  = *reinterpret_cast< unsigned* >( cq + p.cq_off.ring_mask );
+		cqes     = reinterpret_cast< io_uring_cqe* >( cq + p.cq_off.cqes );
+
+		/* One slot per submission queue entry, so there are never more
+		 * requests in flight than there is room for completions
+		 */
+		slots.resize(p.sq_entries);
+		iovecs.resize(p.sq_entries);
+
+		for ( unsigned i = p.sq_entries; i > 0; --i )
+		{
+			free_slots.push_back(i - 1);
+		}
+
+		return true;
+	}
+
+	bool submit(request& r)
+	{
+		cpp::unique_lock< cpp::mutex > lock(m);
+
+		while ( free_slots.empty() )
+		{
+			reap(lock);
+		}
+
+		const unsigned slot = free_slots.back();
+
+		/* The iovec belongs to the slot until the read completes, since the
+		 * kernel may look at it again if the read is handed off to a worker
+		 */
+		iovecs[slot].iov_base = r.buffer;
+		iovecs[slot].iov_len  = r.length;
+		slots[slot]           = &r;
+
+		const unsigned tail  = *sq_tail;
+		const unsigned index = tail & sq_mask;
+
+		io_uring_sqe* sqe = &sqes[index];
+		std::memset(sqe, 0, sizeof( *sqe ) );
+		sqe->opcode    = IORING_OP_READV;
+		sqe->fd        = r.fd;
+		sqe->off       = static_cast< unsigned long long >( r.offset );
+		sqe->addr      = static_cast< unsigned long long >( reinterpret_cast< uintptr_t >( &iovecs[slot] ) );
+		sqe->len       = 1;
+		sqe->user_data = slot;
+
+		sq_array[index] = index;
+		r.done          = false;
+
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+		int res = 0;
+
+		do
+		{
+			res = io_uring_enter(ring, 1, 0, 0);
+		}
+		while ( res < 0 && errno == EINTR );
+
+		if ( res != 1 )
+		{
+			// Not consumed by the kernel. Take it back
+			__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+			return false;
+		}
+
+		free_slots.pop_back();
+
+		return true;
+	}
+
+	void wait(request& r)
+	{
+		cpp::unique_lock< cpp::mutex > lock(m);
+
+		while ( !r.done )
+		{
+			reap(lock);
+		}
+	}
+private:
+	/** Wait for at least one completion, or for another thread to reap
+	 */
+	void reap(cpp::unique_lock< cpp::mutex >& lock)
+	{
+		if ( reaping )
+		{
+			completed.wait(lock);
+
+			return;
+		}
+
+		reaping = true;
+		lock.unlock();
+		io_uring_enter(ring, 0, 1, IORING_ENTER_GETEVENTS);
+		lock.lock();
+		reaping = false;
+
+		unsigned       head = *cq_head;
+		const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+		for (; head != tail; ++head )
+		{
+			const io_uring_cqe& cqe  = cqes[head & cq_mask];
+			const unsigned      slot = static_cast< unsigned >( cqe.user_data );
+
+			if ( request* r = slots[slot] )
+			{
+				r->result   = cqe.res;
+				r->done     = true;
+				slots[slot] = 0;
+				free_slots.push_back(slot);
+			}
+		}
+
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+		completed.notify_all();
+	}
+
+	int           ring;
+	void*         sq_ptr;
+	std::size_t   sq_size;
+	void*         cq_ptr;
+	std::size_t   cq_size;
+	io_uring_sqe* sqes;
+	std::size_t   sqes_size;
+
+	unsigned*     sq_head;
+	unsigned*     sq_tail;
+	unsigned      sq_mask;
+	unsigned*     sq_array;
+	unsigned*     cq_head;
+	unsigned*     cq_tail;
+	unsigned      cq_mask;
+	io_uring_cqe* cqes;
+
+	cpp::mutex              m;
+	cpp::condition_variable completed;
+
+	/// Request using each slot, or null
+	std::vector< request* > slots;
+	std::vector< iovec >    iovecs;
+	std::vector< unsigned > free_slots;
+
+	bool reaping;
+};
+
+#endif // ifdef PBL_FS_IO_URING
+}
+
+namespace pbl
+{
+namespace fs
+{
+AsyncReader::~AsyncReader()
+{
+}
+
+AsyncReader* AsyncReader::create(unsigned depth)
+{
+	if ( depth == 0 )
+	{
+		depth = 1;
+	}
+
+	#ifdef PBL_FS_IO_URING
+	uring_reader* r = new uring_reader;
+
+	if ( r->init(depth) )
+	{
+		return r;
+	}
+
+	delete r;
+	#endif
+
+	return new threaded_reader(depth < max_reader_threads ? depth : max_reader_threads);
+}
+
+}
+}
@@ -0,0 +1,82 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PBL_FILEUTIL_ASYNCREADER_H
+#define PBL_FILEUTIL_ASYNCREADER_H
+
+#include <cstddef>
+
+namespace pbl
+{
+namespace fs
+{
+/** Reads blocks of files in the background, keeping many reads in flight
+ *
+ * One reader can be shared by several threads, each waiting for its own
+ * requests. Use create() to get the best implementation for the platform.
+ */
+class AsyncReader
+{
+public:
+	/** A single read. Must stay alive (and unmodified) until it completes
+	 */
+	struct request
+	{
+		int         fd;
+		long long   offset;
+		char*       buffer;
+		std::size_t length;
+
+		/// Number of bytes read, or -errno. Valid once the request is done
+		long result;
+		bool done;
+	};
+
+	virtual ~AsyncReader();
+
+	/** Start a read
+	 * @returns false if the read could not be started. The request is not
+	 * pending in that case.
+	 */
+	virtual bool submit(request&) = 0;
+
+	/** Block until the request has completed
+	 */
+	virtual void wait(request&) = 0;
+
+	/** Create a reader that can have about depth reads in flight
+	 *
+	 * Uses io_uring where the kernel supports it, and a pool of threads
+	 * calling pread otherwise.
+	 */
+	static AsyncReader* create(unsigned depth);
+};
+}
+}
+
+#endif // PBL_FILEUTIL_ASYNCREADER_H
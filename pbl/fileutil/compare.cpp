@@ -27,9 +27,13 @@
    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include "compare.h"
+#include "memdiff.h"
+#include "asyncreader.h"
 
+#include <algorithm>
 #include <cstring>
 #include <cerrno>
+#include <vector>
 
 #if !defined( _WIN32 ) && ( defined( __unix__ ) || defined( __unix ) || ( defined( __APPLE__ ) && defined( __MACH__ )  ) )
 #include <unistd.h>
@@ -37,17 +41,584 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#if defined( _POSIX_MAPPED_FILES ) && _POSIX_MAPPED_FILES > 0
+#include <sys/mman.h>
+#include <csetjmp>
+#include <csignal>
+#include <pthread.h>
+#define PBL_FS_COMPARE_MAPPED
 #endif
 #endif
+#endif
+
+namespace
+{
+/** Find the first byte that differs between two blocks
+ *
+ * std::memcmp is faster at telling that blocks are the same, which is the
+ * common case. first_difference is only used to locate the difference.
+ *
+ * @returns n if the blocks are the same
+ */
+std::size_t find_difference(
+	const void* a,
+	const void* b,
+	std::size_t n
+)
+{
+	return std::memcmp(a, b, n) == 0 ? n : pbl::fs::first_difference(a, b, n);
+}
+
+#ifdef PBL_FS_COMPARE_MAPPED
+/// Amount of each file that is mapped at one time
+const long long mapped_window = 64 * 1024 * 1024;
+
+/// Amount of a mapped window compared between checks for cancellation
+const std::size_t mapped_step = 1024 * 1024;
+
+/** Where to jump when a mapped file is truncated while this thread reads it,
+ * or null if the thread is not reading a mapped file
+ */
+__thread sigjmp_buf* bus_jump = 0;
+
+/// What SIGBUS did before on_sigbus was installed
+struct sigaction previous_sigbus;
+
+pthread_once_t sigbus_once = PTHREAD_ONCE_INIT;
+
+/** Turn a SIGBUS from reading a truncated mapping into a jump back to
+ * compare_mapped. Other SIGBUS are passed on
+ */
+extern "C" void on_sigbus(
+	int        sig,
+	siginfo_t* info,
+	void*      context
+)
+{
+	if ( sigjmp_buf* j = bus_jump )
+	{
+		bus_jump = 0;
+		::siglongjmp(*j, 1);
+	}
+
+	if ( previous_sigbus.sa_flags & SA_SIGINFO )
+	{
+		previous_sigbus.sa_sigaction(sig, info, context);
+	}
+	else if ( previous_sigbus.sa_handler != SIG_DFL && previous_sigbus.sa_handler != SIG_IGN )
+	{
+		previous_sigbus.sa_handler(sig);
+	}
+	else if ( previous_sigbus.sa_handler == SIG_IGN && info->si_code <= 0 )
+	{
+		// Sent by kill() or the like, and ignored as before
+	}
+	else
+	{
+		/* Handle it as it would have been. A fault can't be ignored: it
+		 * would happen again as soon as this returns
+		 */
+		struct sigaction act = previous_sigbus;
+
+		if ( act.sa_handler == SIG_IGN )
+		{
+			act.sa_handler = SIG_DFL;
+		}
+
+		::sigaction(SIGBUS, &act, 0);
+		::raise(sig);
+	}
+}
+
+extern "C" void install_sigbus()
+{
+	struct sigaction act;
+
+	std::memset(&act, 0, sizeof( act ) );
+	act.sa_sigaction = on_sigbus;
+	act.sa_flags     = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&act.sa_mask);
+	::sigaction(SIGBUS, &act, &previous_sigbus);
+}
+
+/** Compare two regular files of the same size by mapping them into memory
+ *
+ * The files are compared from offset 0, a window at a time, without copying
+ * the data into user space buffers.
+ *
+ * @returns false if the files could not be mapped, or one was truncated while
+ * it was being compared, in which case the caller should read them as streams
+ * instead
+ */
+bool compare_mapped(
+	int                            fd1,
+	int                            fd2,
+	long long                      size,
+	const pbl::cancellation_token& cancel,
+	pbl::fs::compare_result&       res,
+	long long*                     difference,
+	pbl::fs::content_hash*         hash
+)
+{
+	pbl::fs::content_hasher hasher;
+
+	::pthread_once(&sigbus_once, install_sigbus);
+
+	for ( long long offset = 0; offset < size; offset += mapped_window )
+	{
+		const std::size_t len = static_cast< std::size_t >( std::min(size - offset, mapped_window) );
+
+		void* p1 = ::mmap(0, len, PROT_READ, MAP_SHARED, fd1, static_cast< off_t >( offset ) );
+
+		if ( p1 == MAP_FAILED )
+		{
+			return false;
+		}
+
+		void* p2 = ::mmap(0, len, PROT_READ, MAP_SHARED, fd2, static_cast< off_t >( offset ) );
+
+		if ( p2 == MAP_FAILED )
+		{
+			::munmap(p1, len);
+
+			return false;
+		}
+
+		#ifdef MADV_SEQUENTIAL
+		::madvise(p1, len, MADV_SEQUENTIAL);
+		::madvise(p2, len, MADV_SEQUENTIAL);
+		#endif
+
+		/* Reading past the end of a file that shrank raises SIGBUS, which
+		 * jumps back here. Files that change are common, so this is not an
+		 * error: the streams will see the new size.
+		 */
+		sigjmp_buf jump;
+
+		if ( sigsetjmp(jump, 1) != 0 )
+		{
+			::munmap(p2, len);
+			::munmap(p1, len);
+
+			return false;
+		}
+
+		bus_jump = &jump;
+
+		std::size_t i         = 0;
+		bool        cancelled = false;
+
+		while ( i < len )
+		{
+			if ( cancel.cancelled() )
+			{
+				cancelled = true;
+				break;
+			}
+
+			const std::size_t n = std::min(len - i, mapped_step);
+			const std::size_t j = find_difference(static_cast< const char* >( p1 ) + i, static_cast< const char* >( p2 ) + i, n);
+
+			if ( hash && j == n )
+			{
+				hasher.update(static_cast< const char* >( p1 ) + i, n);
+			}
+
+			i += j;
+
+			if ( j != n )
+			{
+				break;
+			}
+		}
+
+		bus_jump = 0;
+
+		::munmap(p2, len);
+		::munmap(p1, len);
+
+		if ( cancelled )
+		{
+			res = pbl::fs::compare_cancelled;
+
+			return true;
+		}
+
+		if ( i != len )
+		{
+			if ( difference )
+			{
+				*difference = offset + static_cast< long long >( i );
+			}
+
+			res = pbl::fs::compare_notequal_content;
+
+			return true;
+		}
+	}
+
+	if ( hash )
+	{
+		*hash = hasher.digest();
+	}
+
+	res = pbl::fs::compare_equal;
+
+	return true;
+}
+
+#endif // ifdef PBL_FS_COMPARE_MAPPED
+
+/// Size of the blocks read when sampling
+const std::size_t sample_block = 64 * 1024;
+
+/// Number of blocks sampled between the first and the last
+const long long sample_strides = 6;
+
+/** Read a whole block at the given offset
+ * @returns false on error or end of file
+ */
+bool read_block(
+	int         fd,
+	long long   offset,
+	char*       buf,
+	std::size_t len
+)
+{
+	while ( len != 0 )
+	{
+		const ssize_t n = ::pread(fd, buf, len, static_cast< off_t >( offset ) );
+
+		if ( n < 0 )
+		{
+			if ( errno != EINTR )
+			{
+				return false;
+			}
+		}
+		else if ( n == 0 )
+		{
+			return false;
+		}
+		else
+		{
+			buf    += n;
+			len    -= static_cast< std::size_t >( n );
+			offset += n;
+		}
+	}
+
+	return true;
+}
+
+/** Compare the first and last blocks of two regular files of the same size,
+ * and a few evenly spaced blocks in between
+ *
+ * Reads with pread, so the position of the files is not changed.
+ *
+ * @returns true if a difference was found. false if the samples are the same,
+ * could not be read, or sampling was cancelled
+ */
+bool samples_differ(
+	int                            fd1,
+	int                            fd2,
+	long long                      size,
+	const pbl::cancellation_token& cancel,
+	long long*                     difference
+)
+{
+	const long long block = static_cast< long long >( sample_block );
+
+	// Small files are cheap enough to read in full
+	if ( size <= block * ( sample_strides + 2 ) )
+	{
+		return false;
+	}
+
+	std::vector< long long > offsets;
+	offsets.push_back(0);
+	offsets.push_back(size - block);
+
+	for ( long long i = 1; i <= sample_strides; ++i )
+	{
+		offsets.push_back( ( size / ( sample_strides + 1 ) * i ) / block * block );
+	}
+
+	std::vector< char > buf1(sample_block);
+	std::vector< char > buf2(sample_block);
+
+	for ( std::size_t i = 0; i < offsets.size(); ++i )
+	{
+		// Each probe may be a slow seek, ex., on a network mount
+		if ( cancel.cancelled() )
+		{
+			return false;
+		}
+
+		if ( !read_block(fd1, offsets[i], &buf1[0], sample_block) || !read_block(fd2, offsets[i], &buf2[0], sample_block) )
+		{
+			return false;
+		}
+
+		const std::size_t j = find_difference(&buf1[0], &buf2[0], sample_block);
+
+		if ( j != sample_block )
+		{
+			if ( difference )
+			{
+				*difference = offsets[i] + static_cast< long long >( j );
+			}
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/// Size of each read made through an AsyncReader
+const std::size_t async_block = 256 * 1024;
+
+/// Number of reads kept in flight for each file
+const std::size_t async_depth = 4;
+
+/** Wait for a read, then read the rest of it if it came back short
+ *
+ * Reads may legally return fewer bytes than asked for, ex., from io_uring,
+ * or from pread on NFS or FUSE. The remainder is submitted again until it is
+ * complete, the end of the file is reached, or there is an error.
+ *
+ * On return, the request describes the whole read again. Its result is the
+ * total number of bytes read, or -errno.
+ */
+void finish_read(
+	pbl::fs::AsyncReader&          reader,
+	pbl::fs::AsyncReader::request& r
+)
+{
+	reader.wait(r);
+
+	char* const       buffer = r.buffer;
+	const std::size_t length = r.length;
+	const long long   offset = r.offset;
+	std::size_t       done   = 0;
+	long              result = 0;
+
+	while ( true )
+	{
+		if ( r.result < 0 && r.result != -EINTR && r.result != -EAGAIN )
+		{
+			result = r.result;
+			break;
+		}
+
+		if ( r.result > 0 )
+		{
+			done += static_cast< std::size_t >( r.result );
+		}
+		else if ( r.result == 0 )
+		{
+			// End of file
+			result = static_cast< long >( done );
+			break;
+		}
+
+		if ( done == length )
+		{
+			result = static_cast< long >( done );
+			break;
+		}
+
+		r.offset = offset + static_cast< long long >( done );
+		r.buffer = buffer + done;
+		r.length = length - done;
+
+		if ( !reader.submit(r) )
+		{
+			result = -EIO;
+			break;
+		}
+
+		reader.wait(r);
+	}
+
+	r.offset = offset;
+	r.buffer = buffer;
+	r.length = length;
+	r.result = result;
+}
+
+/** Compare two regular files of the same size, keeping several reads of
+ * each file in flight with an AsyncReader
+ *
+ * Blocks are compared (and hashed) in order while the reads for the blocks
+ * after them are outstanding. All reads are waited for before returning,
+ * since they refer to local buffers.
+ *
+ * @returns false if the reads could not be started, in which case the caller
+ * should read the files some other way
+ */
+bool compare_async(
+	int                            fd1,
+	int                            fd2,
+	long long                      size,
+	pbl::fs::AsyncReader&          reader,
+	const pbl::cancellation_token& cancel,
+	pbl::fs::compare_result&       res,
+	long long*                     difference,
+	pbl::fs::content_hash*         hash
+)
+{
+	typedef pbl::fs::AsyncReader::request request;
+
+	std::vector< char >    buf(2 * async_depth * async_block);
+	std::vector< request > reqs(2 * async_depth);
+	std::vector< bool >    pending(async_depth, false);
+
+	pbl::fs::content_hasher hasher;
+
+	long long next    = 0; // offset of the next block to submit
+	long long offset  = 0; // offset of the next block to compare
+	bool      started = true;
+
+	res = pbl::fs::compare_equal;
+
+	for ( std::size_t k = 0; offset < size; k = ( k + 1 ) % async_depth )
+	{
+		if ( cancel.cancelled() )
+		{
+			res = pbl::fs::compare_cancelled;
+			break;
+		}
+
+		// Keep the pipeline full
+		for ( std::size_t j = 0; j < async_depth && started && next < size; ++j )
+		{
+			const std::size_t s = ( k + j ) % async_depth;
+
+			if ( pending[s] )
+			{
+				continue;
+			}
+
+			const std::size_t len = static_cast< std::size_t >( std::min(size - next, static_cast< long long >( async_block ) ) );
+
+			for ( std::size_t f = 0; f < 2; ++f )
+			{
+				request& r = reqs[2 * s + f];
+
+				r.fd     = ( f == 0 ? fd1 : fd2 );
+				r.offset = next;
+				r.buffer = &buf[( 2 * s + f ) * async_block];
+				r.length = len;
+			}
+
+			if ( !reader.submit(reqs[2 * s]) )
+			{
+				started = false;
+				break;
+			}
+
+			if ( !reader.submit(reqs[2 * s + 1]) )
+			{
+				reader.wait(reqs[2 * s]);
+				started = false;
+				break;
+			}
+
+			pending[s] = true;
+			next      += static_cast< long long >( len );
+		}
+
+		if ( !pending[k] )
+		{
+			// Could not start the reads for this block
+			res = pbl::fs::compare_error_read;
+			break;
+		}
+
+		request& r1 = reqs[2 * k];
+		request& r2 = reqs[2 * k + 1];
+
+		finish_read(reader, r1);
+		finish_read(reader, r2);
+		pending[k] = false;
+
+		if ( r1.result < 0 || r2.result < 0 )
+		{
+			res = pbl::fs::compare_error_read;
+			break;
+		}
+
+		// The end of a file came early, so it shrank while being compared
+		if ( r1.result != static_cast< long >( r1.length ) || r2.result != static_cast< long >( r2.length ) )
+		{
+			res = pbl::fs::compare_notequal_sizes;
+			break;
+		}
+
+		const std::size_t i = find_difference(r1.buffer, r2.buffer, r1.length);
+
+		if ( i != r1.length )
+		{
+			if ( difference )
+			{
+				*difference = offset + static_cast< long long >( i );
+			}
+
+			res = pbl::fs::compare_notequal_content;
+			break;
+		}
+
+		if ( hash )
+		{
+			hasher.update(r1.buffer, r1.length);
+		}
+
+		offset += static_cast< long long >( r1.length );
+	}
+
+	// Don't leave reads in flight into buffers that are going away
+	for ( std::size_t s = 0; s < async_depth; ++s )
+	{
+		if ( pending[s] )
+		{
+			reader.wait(reqs[2 * s]);
+			reader.wait(reqs[2 * s + 1]);
+		}
+	}
+
+	if ( res == pbl::fs::compare_error_read && offset == 0 && !started )
+	{
+		// Nothing was read. Let the caller try another way
+		return false;
+	}
+
+	if ( res == pbl::fs::compare_equal && hash )
+	{
+		*hash = hasher.digest();
+	}
+
+	return true;
+}
+
+}
 
 namespace pbl
 {
 namespace fs
 {
+compare_options::compare_options()
+	: sizelimit(0), sample(false), reader(0)
+{
+}
+
 compare_result compare(
 	const std::string& first,
 	const std::string& second,
-	long long          sizelimit
+	long long          sizelimit,
+	long long*         difference,
+	content_hash*      hash
 )
 {
 	compare_result res = compare_error_open;
@@ -56,7 +627,7 @@ compare_result compare(
 	{
 		if ( std::FILE* fd2 = std::fopen(second.c_str(), "rb") )
 		{
-			res = compare(fd1, fd2, sizelimit);
+			res = compare(fd1, fd2, sizelimit, difference, hash);
 
 			std::fclose(fd2);
 		}
@@ -68,11 +639,30 @@ compare_result compare(
 }
 
 compare_result compare(
-	std::FILE* file1,
-	std::FILE* file2,
-	long long  sizelimit
+	std::FILE*    file1,
+	std::FILE*    file2,
+	long long     sizelimit,
+	long long*    difference,
+	content_hash* hash
 )
 {
+	compare_options options;
+
+	options.sizelimit = sizelimit;
+
+	return compare(file1, file2, options, difference, hash);
+}
+
+compare_result compare(
+	std::FILE*             file1,
+	std::FILE*             file2,
+	const compare_options& options,
+	long long*             difference,
+	content_hash*          hash
+)
+{
+	const long long sizelimit = options.sizelimit;
+
 	if ( !file1 || !file2 )
 	{
 		return compare_error_null;
@@ -114,6 +704,48 @@ compare_result compare(
 			{
 				return compare_error_too_big;
 			}
+
+			// Look for a difference in the most likely places first
+			if ( options.sample && res1 && res2 && S_ISREG(s1.st_mode) && S_ISREG(s2.st_mode) )
+			{
+				if ( samples_differ(fd1, fd2, s1.st_size, options.cancel, difference) )
+				{
+					return compare_notequal_content;
+				}
+
+				if ( options.cancel.cancelled() )
+				{
+					return compare_cancelled;
+				}
+			}
+
+			// Read regular files in the background, several blocks ahead
+			if ( options.reader && res1 && res2 && S_ISREG(s1.st_mode) && S_ISREG(s2.st_mode) )
+			{
+				compare_result res = compare_error_read;
+
+				if ( compare_async(fd1, fd2, s1.st_size, *options.reader, options.cancel, res, difference, hash) )
+				{
+					return res;
+				}
+			}
+
+			#ifdef PBL_FS_COMPARE_MAPPED
+
+			/* Regular files that haven't been read from yet can be compared
+			 * in place. Pipes (ex., from a command) are read as streams.
+			 */
+			if ( res1 && res2 && S_ISREG(s1.st_mode) && S_ISREG(s2.st_mode)
+			     && std::ftell(file1) == 0 && std::ftell(file2) == 0 )
+			{
+				compare_result res = compare_error_read;
+
+				if ( compare_mapped(fd1, fd2, s1.st_size, options.cancel, res, difference, hash) )
+				{
+					return res;
+				}
+			}
+			#endif
 		}
 	}
 
@@ -127,8 +759,18 @@ compare_result compare(
 	bool eof1 = false;
 	bool eof2 = false;
 
+	// Number of bytes that have compared equal
+	long long offset = 0;
+
+	content_hasher hasher;
+
 	while ( true )
 	{
+		if ( options.cancel.cancelled() )
+		{
+			return compare_cancelled;
+		}
+
 		// read from each file
 		if ( !eof1 && size1 < sizeof( buf1 ) )
 		{
@@ -188,15 +830,32 @@ compare_result compare(
 		const std::size_t m = std::min(size1, size2);
 
 		// files are different
-		if ( std::memcmp(buf1, buf2, m) != 0 )
+		const std::size_t i = find_difference(buf1, buf2, m);
+
+		if ( i != m )
 		{
+			if ( difference )
+			{
+				*difference = offset + static_cast< long long >( i );
+			}
+
 			return compare_notequal_content;
 		}
 		else
 		{
+			if ( hash )
+			{
+				hasher.update(buf1, m);
+			}
+
 			// files are the same
 			if ( eof1 && eof2 )
 			{
+				if ( hash )
+				{
+					*hash = hasher.digest();
+				}
+
 				return compare_equal;
 			}
 
@@ -215,6 +874,8 @@ compare_result compare(
 
 			size2 -= m;
 
+			offset += static_cast< long long >( m );
+
 			// files have different size
 			if ( ( eof1 && size2 != 0 ) || ( eof2 && size1 != 0 ) )
 			{
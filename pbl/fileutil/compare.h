@@ -32,6 +32,9 @@
 #include <string>
 #include <cstdio>
 #include "../util/return_code.h"
+#include "../util/cancellation.h"
+#include "contenthash.h"
+#include "asyncreader.h"
 
 namespace pbl
 {
@@ -45,13 +48,55 @@ enum compare_result_enum
 	compare_error_open,
 	compare_error_null,
 	compare_error_too_big,
-	compare_error_read
+	compare_error_read,
+	compare_cancelled
 };
 
 typedef return_code< compare_result_enum > compare_result;
 
-compare_result compare(const std::string&, const std::string&, long long);
-compare_result compare(std::FILE*, std::FILE*, long long);
+/** How two files should be compared
+ */
+struct compare_options
+{
+	compare_options();
+
+	/// Files larger than this many bytes are not compared. 0 for no limit
+	long long sizelimit;
+
+	/** Before reading regular files in full, check their first and last
+	 * blocks, and a few blocks in between. Files that differ in a header or
+	 * trailer are found without reading the rest of the file.
+	 */
+	bool sample;
+
+	/** If not null, regular files are read through this reader, with several
+	 * blocks in flight at once, instead of being mapped into memory
+	 */
+	AsyncReader* reader;
+
+	/// Checked between blocks. The comparison stops early if it is cancelled
+	cancellation_token cancel;
+};
+
+/** Compare the contents of two files
+ *
+ * Regular files may be mapped into memory. Reading a mapping of a file that
+ * another process truncates raises SIGBUS, so the first mapped compare
+ * installs a process-wide SIGBUS handler. It turns such a fault into a read
+ * error on the mapping, after which the files are read as streams. Any other
+ * SIGBUS goes to the handler that was installed before, or gets the default
+ * action. A handler installed later must pass SIGBUS on to this one.
+ *
+ * @param sizelimit Files larger than this many bytes are not compared. 0 for
+ * no limit
+ * @param difference If not null, receives the offset of the first byte
+ * that differs when the result is compare_notequal_content
+ * @param hash If not null, receives the hash of the contents when the files
+ * were read in full and found to be equal. Otherwise it is not modified.
+ */
+compare_result compare(const std::string&, const std::string&, long long sizelimit, long long* difference = 0, content_hash* hash = 0);
+compare_result compare(std::FILE*, std::FILE*, long long sizelimit, long long* difference = 0, content_hash* hash = 0);
+compare_result compare(std::FILE*, std::FILE*, const compare_options&, long long* difference = 0, content_hash* hash = 0);
 }
 }
 
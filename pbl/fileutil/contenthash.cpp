@@ -0,0 +1,258 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "contenthash.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+/// Size of each read when hashing a file
+const std::size_t file_block = 64 * 1024;
+
+const unsigned long long c1 = 0x87c37b91114253d5ULL;
+const unsigned long long c2 = 0x4cf5ad432745937fULL;
+
+inline unsigned long long rotl(
+	unsigned long long x,
+	int                r
+)
+{
+	return ( x << r ) | ( x >> ( 64 - r ) );
+}
+
+inline unsigned long long fmix(unsigned long long k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+
+	return k;
+}
+
+inline unsigned long long load(const unsigned char* p)
+{
+	unsigned long long x = 0;
+
+	for ( int i = 7; i >= 0; --i )
+	{
+		x = ( x << 8 ) | p[i];
+	}
+
+	return x;
+}
+
+}
+
+namespace pbl
+{
+namespace fs
+{
+bool operator==(
+	const content_hash& a,
+	const content_hash& b
+)
+{
+	return a.h1 == b.h1 && a.h2 == b.h2 && a.size == b.size;
+}
+
+bool operator!=(
+	const content_hash& a,
+	const content_hash& b
+)
+{
+	return !( a == b );
+}
+
+content_hasher::content_hasher()
+	: h1(0), h2(0), length(0), tail(), ntail(0)
+{
+}
+
+void content_hasher::block(const unsigned char* p)
+{
+	unsigned long long k1 = load(p);
+	unsigned long long k2 = load(p + 8);
+
+	k1 *= c1;
+	k1  = rotl(k1, 31);
+	k1 *= c2;
+	h1 ^= k1;
+	h1  = rotl(h1, 27);
+	h1 += h2;
+	h1  = h1 * 5 + 0x52dce729;
+
+	k2 *= c2;
+	k2  = rotl(k2, 33);
+	k2 *= c1;
+	h2 ^= k2;
+	h2  = rotl(h2, 31);
+	h2 += h1;
+	h2  = h2 * 5 + 0x38495ab5;
+}
+
+void content_hasher::update(
+	const void* data,
+	std::size_t n
+)
+{
+	const unsigned char* p = static_cast< const unsigned char* >( data );
+
+	length += static_cast< long long >( n );
+
+	// Finish a partial block from a previous update
+	if ( ntail != 0 )
+	{
+		const std::size_t m = ( n < sizeof( tail ) - ntail ) ? n : sizeof( tail ) - ntail;
+
+		std::memcpy(tail + ntail, p, m);
+		ntail += m;
+		p     += m;
+		n     -= m;
+
+		if ( ntail < sizeof( tail ) )
+		{
+			return;
+		}
+
+		block(tail);
+		ntail = 0;
+	}
+
+	for (; n >= 16; p += 16, n -= 16 )
+	{
+		block(p);
+	}
+
+	std::memcpy(tail, p, n);
+	ntail = n;
+}
+
+content_hash content_hasher::digest() const
+{
+	unsigned long long a = h1;
+	unsigned long long b = h2;
+
+	unsigned long long k1 = 0;
+	unsigned long long k2 = 0;
+
+	for ( std::size_t i = ntail; i > 8; --i )
+	{
+		k2 = ( k2 << 8 ) | tail[i - 1];
+	}
+
+	for ( std::size_t i = ( ntail < 8 ? ntail : 8 ); i > 0; --i )
+	{
+		k1 = ( k1 << 8 ) | tail[i - 1];
+	}
+
+	if ( ntail > 8 )
+	{
+		k2 *= c2;
+		k2  = rotl(k2, 33);
+		k2 *= c1;
+		b  ^= k2;
+	}
+
+	if ( ntail > 0 )
+	{
+		k1 *= c1;
+		k1  = rotl(k1, 31);
+		k1 *= c2;
+		a  ^= k1;
+	}
+
+	const unsigned long long len = static_cast< unsigned long long >( length );
+
+	a ^= len;
+	b ^= len;
+	a += b;
+	b += a;
+	a  = fmix(a);
+	b  = fmix(b);
+	a += b;
+	b += a;
+
+	content_hash h = { a, b, length };
+
+	return h;
+}
+
+bool hash_file(
+	const std::string&        path,
+	std::size_t               max,
+	const cancellation_token& cancel,
+	content_hash&             hash
+)
+{
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+
+	if ( !file )
+	{
+		return false;
+	}
+
+	content_hasher      h;
+	std::vector< char > buf(file_block);
+	std::size_t         total = 0;
+	bool                ok    = true;
+
+	while ( max == 0 || total < max )
+	{
+		const std::size_t want = max == 0 ? buf.size() : std::min(buf.size(), max - total);
+		const std::size_t k    = std::fread(&buf[0], 1, want, file);
+
+		h.update(&buf[0], k);
+		total += k;
+
+		if ( k < want )
+		{
+			ok = !std::ferror(file);
+			break;
+		}
+
+		if ( cancel.cancelled() )
+		{
+			ok = false;
+			break;
+		}
+	}
+
+	std::fclose(file);
+	hash = h.digest();
+
+	return ok;
+}
+
+}
+}
@@ -0,0 +1,91 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PBL_FILEUTIL_CONTENTHASH_H
+#define PBL_FILEUTIL_CONTENTHASH_H
+
+#include <cstddef>
+#include <string>
+
+#include "../util/cancellation.h"
+
+namespace pbl
+{
+namespace fs
+{
+/** A 128 bit hash of a file's contents, and the number of bytes hashed
+ */
+struct content_hash
+{
+	unsigned long long h1;
+	unsigned long long h2;
+	long long          size;
+};
+
+bool operator==(const content_hash&, const content_hash&);
+bool operator!=(const content_hash&, const content_hash&);
+
+/** Incrementally hash a stream of bytes
+ *
+ * Uses MurmurHash3 (x64, 128 bit). This is not a cryptographic hash. It is
+ * meant for recognizing files that have not changed, not for defending
+ * against deliberate collisions.
+ */
+class content_hasher
+{
+public:
+	content_hasher();
+
+	/** Add bytes to the hash
+	 */
+	void update(const void*, std::size_t);
+
+	/** Get the hash of all of the bytes added so far
+	 */
+	content_hash digest() const;
+private:
+	void block(const unsigned char*);
+
+	unsigned long long h1;
+	unsigned long long h2;
+	long long          length;
+
+	/// Bytes that don't yet make up a complete block
+	unsigned char tail[16];
+	std::size_t   ntail;
+};
+
+/** Hash the start of a file, or all of it
+ * @param max Number of bytes to hash from the start. 0 for the whole file
+ * @returns false if the file could not be read, or hashing was cancelled
+ */
+bool hash_file(const std::string& path, std::size_t max, const cancellation_token& cancel, content_hash& hash);
+}
+}
+
+#endif // PBL_FILEUTIL_CONTENTHASH_H
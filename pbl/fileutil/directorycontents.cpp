@@ -30,82 +30,1780 @@
 
 #include <algorithm>
 #include <climits>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+
+#include "cpp/condition_variable.h"
 #include "cpp/filesystem.h"
+#include "cpp/mutex.h"
+#include "cpp/thread.h"
+
+#include "pbl/config/os.h"
+#include "pbl/util/strings.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+bool is_hidden(const char* name)
+{
+	return name[0] == '.';
+}
+
+bool is_absolute(const std::string& s)
+{
+	return !s.empty() && s[0] == '/';
+}
+
+/** Continue a 32 bit FNV-1a hash with more bytes
+ */
+unsigned fnv1a(
+	unsigned    h,
+	const char* s,
+	std::size_t n
+)
+{
+	for ( std::size_t i = 0; i < n; ++i )
+	{
+		h = ( h ^ static_cast< unsigned char >( s[i] ) ) * 16777619u;
+	}
+
+	return h;
+}
+
+const unsigned fnv1a_basis = 2166136261u;
+
+/** Identifies the rules a tree was scanned with. 0 if there were none
+ */
+unsigned hash_rules(
+	const pbl::fs::IgnoreRules& rules,
+	bool                        gitignore
+)
+{
+	if ( rules.empty() && !gitignore )
+	{
+		return 0;
+	}
+
+	const unsigned h = rules.fingerprint();
+
+	return gitignore ? fnv1a(h, "\n", 1) : h;
+}
+
+long long mtime_ns(const struct stat& s)
+{
+	#ifdef POSIX_ISSUE_7
+	return static_cast< long long >( s.st_mtim.tv_sec ) * 1000000000LL + static_cast< long long >( s.st_mtim.tv_nsec );
+	#else
+	return static_cast< long long >( s.st_mtime ) * 1000000000LL;
+	#endif
+}
+
+/** Modification and status change times of an open file, in nanoseconds,
+ * and its device
+ *
+ * The times are -1 if they are not known.
+ */
+void get_times(
+	int                 fd,
+	long long&          mtime,
+	long long&          ctime,
+	unsigned long long& device
+)
+{
+	struct stat s;
+
+	if ( ::fstat(fd, &s) != 0 )
+	{
+		mtime  = -1;
+		ctime  = -1;
+		device = 0;
+	}
+	else
+	{
+		device = static_cast< unsigned long long >( s.st_dev );
+		mtime  = mtime_ns(s);
+		#ifdef POSIX_ISSUE_7
+		ctime = static_cast< long long >( s.st_ctim.tv_sec ) * 1000000000LL + static_cast< long long >( s.st_ctim.tv_nsec );
+		#else
+		ctime = static_cast< long long >( s.st_ctime ) * 1000000000LL;
+		#endif
+	}
+}
+
+/// Identifies the snapshot file format
+const char snapshot_magic[8] = { 'p', 'b', 'l', 'd', 'i', 'r', 's', '4' };
+
+/// Number of directories, subdirectory entries, files, bytes of names,
+/// whether there is metadata, and the hash of the ignore rules
+const std::size_t snapshot_counts = 6;
+
+template< typename T >
+bool write_array(
+	std::FILE*              file,
+	const std::vector< T >& v
+)
+{
+	return v.empty() || std::fwrite(&v[0], sizeof( T ), v.size(), file) == v.size();
+}
+
+/** Copies arrays out of a mapped snapshot, checking that each one fits
+ */
+class snapshot_reader
+{
+public:
+	snapshot_reader(
+		const char* p_,
+		std::size_t n_
+	)
+		: p(p_), n(n_)
+	{
+	}
+
+	template< typename T >
+	bool read(
+		std::vector< T >& v,
+		std::size_t       count
+	)
+	{
+		if ( count > n / sizeof( T ) )
+		{
+			return false;
+		}
+
+		const T* first = reinterpret_cast< const T* >( p );
+
+		v.assign(first, first + count);
+		p += count * sizeof( T );
+		n -= count * sizeof( T );
+
+		return true;
+	}
+
+	bool read(
+		std::string& s,
+		std::size_t  count
+	)
+	{
+		if ( count > n )
+		{
+			return false;
+		}
+
+		s.assign(p, count);
+		p += count;
+		n -= count;
+
+		return true;
+	}
+
+	bool at_end() const
+	{
+		return n == 0;
+	}
+private:
+	const char* p;
+	std::size_t n;
+};
+
+}
+
+/** Storage for a tree of directories
+ *
+ * Directories are numbered from 0, the root, in the order they were added.
+ * Each array below has one element per directory. Names are offsets into the
+ * arena, so a tree is limited to 4 GiB of names.
+ *
+ * Directories can also be looked up by their path relative to the root,
+ * through a hash table that is built once the tree is complete.
+ *
+ * A directory can be read again without rebuilding the tree: its old
+ * contents are dropped, and the new ones are appended to the arrays. What
+ * was dropped stays in the arrays, unreachable, until the tree is rebuilt.
+ */
+struct DirectoryContents::tree
+{
+	static const index_type npos = static_cast< index_type >( -1 );
+
+	tree()
+		: metadata(false), rules_hash(0), garbage(0)
+	{
+	}
+
+	/** Add a name to the arena
+	 * @returns Its offset
+	 */
+	index_type add_name(const char* s)
+	{
+		const index_type off = static_cast< index_type >( names.size() );
+
+		names.append(s);
+		names.push_back('\0');
+
+		return off;
+	}
+
+	/** Add a directory that has not been read yet
+	 * @returns Its index
+	 */
+	index_type add_dir(
+		const char* s,
+		index_type  parent_
+	)
+	{
+		const index_type id = static_cast< index_type >( name.size() );
+
+		unsigned h = fnv1a_basis;
+
+		if ( id != 0 )
+		{
+			h = ( parent_ != 0 ) ? fnv1a(path_hash[parent_], "/", 1) : h;
+			h = fnv1a( h, s, std::strlen(s) );
+		}
+
+		name.push_back( add_name(s) );
+		parent.push_back(parent_);
+		path_hash.push_back(h);
+		first_dir.push_back(0);
+		ndirs.push_back(0);
+		first_file.push_back(0);
+		nfiles.push_back(0);
+		scanned.push_back(0);
+		mtime.push_back(-1);
+		ctime.push_back(-1);
+
+		if ( metadata )
+		{
+			device.push_back(0);
+		}
+
+		return id;
+	}
+
+	const char* name_of(index_type d) const
+	{
+		return names.data() + name[d];
+	}
+
+	index_type subdir(
+		index_type  d,
+		std::size_t i
+	) const
+	{
+		return dirs[first_dir[d] + i];
+	}
+
+	/** Index every directory but the root by its path
+	 */
+	void build_index()
+	{
+		std::size_t n = 16;
+
+		while ( n < 2 * name.size() )
+		{
+			n *= 2;
+		}
+
+		index.assign(n, npos);
+
+		for ( std::size_t d = 1; d < name.size(); ++d )
+		{
+			// Removed directories can't be found anyway
+			if ( parent[d] != d )
+			{
+				add_to_index( static_cast< index_type >( d ) );
+			}
+		}
+	}
+
+	/** Index the directories from first on, ex., ones that were appended
+	 *
+	 * Directories that were removed are left in the index, where they never
+	 * match, until it is rebuilt.
+	 */
+	void extend_index(index_type first)
+	{
+		if ( index.size() < 2 * name.size() )
+		{
+			build_index();
+		}
+		else
+		{
+			for ( std::size_t d = first; d < name.size(); ++d )
+			{
+				add_to_index( static_cast< index_type >( d ) );
+			}
+		}
+	}
+
+	void add_to_index(index_type d)
+	{
+		const std::size_t m = index.size() - 1;
+		std::size_t       i = path_hash[d] & m;
+
+		while ( index[i] != npos )
+		{
+			i = ( i + 1 ) & m;
+		}
+
+		index[i] = d;
+	}
+
+	/** Find a directory by its path relative to the root
+	 * @returns The directory, or npos if it is not in the tree
+	 */
+	index_type find(const std::string& path) const
+	{
+		if ( !index.empty() )
+		{
+			const unsigned    h = fnv1a( fnv1a_basis, path.data(), path.length() );
+			const std::size_t m = index.size() - 1;
+
+			for ( std::size_t i = h & m; index[i] != npos; i = ( i + 1 ) & m )
+			{
+				if ( path_hash[index[i]] == h && is_path( index[i], path.data(), path.length() ) )
+				{
+					return index[i];
+				}
+			}
+		}
+
+		return npos;
+	}
+
+	/** Check a directory's path by following its parents up to the root
+	 */
+	bool is_path(
+		index_type  d,
+		const char* p,
+		std::size_t n
+	) const
+	{
+		while ( d != 0 )
+		{
+			const char*       s = name_of(d);
+			const std::size_t k = std::strlen(s);
+
+			if ( parent[d] == d || k > n || std::memcmp(p + ( n - k ), s, k) != 0 )
+			{
+				return false;
+			}
+
+			n -= k;
+			d  = parent[d];
+
+			if ( d != 0 )
+			{
+				if ( n == 0 || p[n - 1] != '/' )
+				{
+					return false;
+				}
+
+				--n;
+			}
+		}
+
+		return n == 0;
+	}
+
+	/** Check that every index is in range, ex., for a tree that was loaded
+	 */
+	bool consistent() const
+	{
+		const std::size_t n = name.size();
+
+		if ( n == 0 || names.empty() || names[names.length() - 1] != '\0' )
+		{
+			return false;
+		}
+
+		if ( metadata && ( device.size() != n || file_size.size() != files.size() || file_mtime.size() != files.size() || file_inode.size() != files.size() ) )
+		{
+			return false;
+		}
+
+		for ( std::size_t d = 0; d < n; ++d )
+		{
+			if ( name[d] >= names.length() || parent[d] >= n
+			     || first_dir[d] > dirs.size() || ndirs[d] > dirs.size() - first_dir[d]
+			     || first_file[d] > files.size() || nfiles[d] > files.size() - first_file[d] )
+			{
+				return false;
+			}
+		}
+
+		for ( std::size_t i = 0; i < dirs.size(); ++i )
+		{
+			if ( dirs[i] >= n )
+			{
+				return false;
+			}
+		}
+
+		for ( std::size_t i = 0; i < files.size(); ++i )
+		{
+			if ( files[i] >= names.length() )
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/** Take a directory out of its parent's range
+	 */
+	void remove(index_type d)
+	{
+		const index_type p = parent[d];
+
+		std::vector< index_type >::iterator first = dirs.begin() + first_dir[p];
+		std::vector< index_type >::iterator last  = first + ndirs[p];
+		std::vector< index_type >::iterator it    = std::find(first, last, d);
+
+		clear_dir(d);
+		std::copy(it + 1, last, it);
+		--ndirs[p];
+		parent[d] = d;
+		++garbage;
+	}
+
+	/** Drop a directory's files and subdirectories, and everything below
+	 * them, and mark it unread
+	 *
+	 * The directory keeps its index, so it can be read again in place. The
+	 * subdirectories below it are removed.
+	 */
+	void clear_dir(index_type d)
+	{
+		std::vector< index_type > stack(1, d);
+
+		while ( !stack.empty() )
+		{
+			const index_type x = stack.back();
+
+			stack.pop_back();
+
+			for ( std::size_t i = 0; i < ndirs[x]; ++i )
+			{
+				const index_type c = subdir(x, i);
+
+				parent[c] = c;
+				stack.push_back(c);
+			}
+
+			// Each subdirectory is dropped from both its range and the directory arrays
+			garbage += 2 * std::size_t(ndirs[x]) + nfiles[x];
+
+			first_dir[x]  = 0;
+			ndirs[x]      = 0;
+			first_file[x] = 0;
+			nfiles[x]     = 0;
+			scanned[x]    = 0;
+			mtime[x]      = -1;
+			ctime[x]      = -1;
+		}
+	}
+
+	/** Number of directories and entries in the arrays that are still used
+	 */
+	std::size_t live() const
+	{
+		return name.size() + dirs.size() + files.size() - garbage;
+	}
+
+	/// Every name, each followed by a NUL
+	std::string names;
+
+	/// Offset of the directory's name. The root's is its full path
+	std::vector< index_type > name;
+
+	/// Index of the parent directory. The root, and any directory that was
+	/// removed, is its own parent
+	std::vector< index_type > parent;
+
+	/// Hash of the directory's path, relative to the root
+	std::vector< unsigned > path_hash;
+
+	/// The range of the directory's subdirectories in dirs
+	std::vector< index_type > first_dir;
+	std::vector< index_type > ndirs;
+
+	/// The range of the directory's files in files
+	std::vector< index_type > first_file;
+	std::vector< index_type > nfiles;
+
+	/// Whether the directory has been read, or is beyond the depth limit
+	std::vector< unsigned char > scanned;
+
+	/// Modification and status change times when the directory was read, in
+	/// nanoseconds, or -1
+	std::vector< long long > mtime;
+	std::vector< long long > ctime;
+
+	/// Indices of subdirectories, sorted by name within each range
+	std::vector< index_type > dirs;
+
+	/// Offsets of file names, sorted within each range
+	std::vector< index_type > files;
+
+	/// Whether the metadata below was recorded. If so, every directory that
+	/// was read has it
+	bool metadata;
+
+	/// Device of each directory
+	std::vector< unsigned long long > device;
+
+	/// Size, modification time and inode of each file, in the same order as
+	/// files. The inode is 0 if the file is on another device than its
+	/// directory, ex., through a symlink
+	std::vector< long long >          file_size;
+	std::vector< long long >          file_mtime;
+	std::vector< unsigned long long > file_inode;
+
+	/// The rules that were followed when scanning, from hash_rules
+	unsigned rules_hash;
+
+	/// Number of directories, and of entries in dirs and files, that were
+	/// dropped from the tree but are still in the arrays
+	std::size_t garbage;
+
+	/// Open addressed hash table of directories, by path_hash
+	std::vector< index_type > index;
+};
+
+const DirectoryContents::index_type DirectoryContents::tree::npos;
+
+DirectoryContents::DirectoryContents()
+	: data(0), node(0), owner(true), metadata(false), gitignore(false)
+{
+}
+
+DirectoryContents::DirectoryContents(
+	tree*      data_,
+	index_type node_
+)
+	: data(data_), node(node_), owner(false), metadata(false), gitignore(false)
+{
+}
+
+DirectoryContents::DirectoryContents(const DirectoryContents& n)
+	: data(n.owner && n.data ? new tree(*n.data) : n.data), node(n.node), owner(n.owner), metadata(n.metadata), ignore_rules(n.ignore_rules), gitignore(n.gitignore)
+{
+}
+
+DirectoryContents::~DirectoryContents()
+{
+	if ( owner )
+	{
+		delete data;
+	}
+}
+
+DirectoryContents& DirectoryContents::operator=(const DirectoryContents& n)
+{
+	DirectoryContents t(n);
+
+	swap(t);
+
+	return *this;
+}
+
+void DirectoryContents::swap(DirectoryContents& n)
+{
+	std::swap(data, n.data);
+	std::swap(node, n.node);
+	std::swap(owner, n.owner);
+	std::swap(metadata, n.metadata);
+	ignore_rules.swap(n.ignore_rules);
+	std::swap(gitignore, n.gitignore);
+}
+
+bool DirectoryContents::valid() const
+{
+	return data != 0;
+}
+
+void DirectoryContents::clear()
+{
+	if ( owner )
+	{
+		delete data;
+	}
+
+	data = 0;
+	node = 0;
+}
+
+/** Scans directories with a pool of threads
+ *
+ * The calling thread scans too, and other threads are only started while
+ * there are directories queued that nobody is free to take, so scanning a
+ * single directory starts none. Each thread has its own queue of
+ * directories. A thread adds the
+ * subdirectories it finds to the back of its own queue and takes work from
+ * the back too, so it stays in one part of the tree. When its queue is
+ * empty, it steals from the front of another thread's queue.
+ *
+ * The threads fill in a temporary tree of listings. Every listing is filled
+ * in by exactly one thread, and the children vector is sized before any
+ * child is queued, so it needs no further locking. Directories that were
+ * already read are taken from the old tree instead of being read again.
+ * When all threads are done, the listings are copied into a new flat tree.
+ *
+ * Subdirectories are opened relative to their parent's descriptor, which is
+ * kept open until all of its subdirectories have been opened. If too many
+ * descriptors are held, a directory's is closed early and its
+ * subdirectories are opened by full path instead.
+ */
+class DirectoryContents::scanner
+{
+public:
+	/**
+	 * @param maxdepth_ How deep to scan
+	 * @param validate_ Read directories again if their modification or status
+	 *   change time changed, instead of taking them from the old tree
+	 * @param cancel_ Stop scanning early. The new tree is incomplete
+	 */
+	scanner(
+		int                            maxdepth_,
+		bool                           validate_ = false,
+		const pbl::cancellation_token& cancel_ = pbl::cancellation_token()
+	)
+		: maxdepth(maxdepth_), validate(validate_), cancel(cancel_), total_added(0), running(false), started(0), pending(0), available(0), sleeping(0), held(0)
+	{
+		for ( std::size_t i = 0, n = thread_count(); i < n; ++i )
+		{
+			queues.push_back(new queue);
+		}
+	}
+
+	~scanner()
+	{
+		for ( std::size_t i = 0; i < queues.size(); ++i )
+		{
+			delete queues[i];
+		}
+
+		for ( std::size_t i = 0; i < roots.size(); ++i )
+		{
+			delete roots[i];
+		}
+	}
+
+	/** Add a tree to scan, before calling run()
+	 */
+	void add(DirectoryContents* root)
+	{
+		const tree*    old   = root->data;
+		const unsigned rules = hash_rules(root->ignore_rules, root->gitignore);
+
+		// A tree that was scanned with other rules is read again
+		listing* l = new listing(old->rules_hash == rules ? old : 0, 0, old->name_of(0), root->metadata);
+
+		if ( rules != 0 )
+		{
+			l->rules     = &root->ignore_rules;
+			l->gitignore = root->gitignore;
+		}
+
+		roots.push_back(l);
+		owners.push_back(root);
+		at.push_back(tree::npos);
+
+		const task t = { l, 0, old->name_of(0), 0 };
+
+		push(total_added++ % queues.size(), t);
+	}
+
+	/** Add a directory of a tree to read again, with everything below it,
+	 * before calling run()
+	 *
+	 * The new contents replace the old ones in place; the rest of the tree
+	 * is not touched. The tree must have been scanned with the owner's
+	 * current rules.
+	 */
+	void add(
+		DirectoryContents* root,
+		index_type         d
+	)
+	{
+		tree& old = *root->data;
+
+		// Full path, and depth, of the directory
+		std::vector< index_type > chain;
+
+		for ( index_type x = d; x != 0; x = old.parent[x] )
+		{
+			chain.push_back(x);
+		}
+
+		std::string path;
+
+		for ( std::size_t i = chain.size(); i > 0; --i )
+		{
+			path += old.name_of(chain[i - 1]);
+			path += '/';
+		}
+
+		paths.push_back( std::string( old.name_of(0) ) + "/" + path.substr(0, path.length() - 1) );
+
+		// The tree records what it always has, so the new contents match the rest
+		listing* l = new listing(0, 0, paths.back().c_str(), old.metadata);
+
+		if ( old.rules_hash != 0 )
+		{
+			l->rules     = inherited_rules(*root, chain);
+			l->gitignore = root->gitignore;
+			l->path      = path;
+		}
+
+		roots.push_back(l);
+		owners.push_back(root);
+		at.push_back(d);
+
+		const task t = { l, 0, paths.back().c_str(), static_cast< int >( chain.size() ) };
+
+		push(total_added++ % queues.size(), t);
+	}
+
+	/** Scan everything that was added, and everything below it, then
+	 * replace the trees that were added
+	 */
+	void run()
+	{
+		for ( std::size_t i = 0; i < queues.size(); ++i )
+		{
+			workers.push_back( new worker(this, i) );
+		}
+
+		// The calling thread is worker 0. Others are started by push()
+		{
+			cpp::lock_guard< cpp::mutex > lock(m);
+
+			running = true;
+			started = 1;
+		}
+
+		start(workers[0]);
+
+		// Nothing is pushed once all tasks are finished, so no more threads are started
+		for ( std::size_t i = 0; i < threads.size(); ++i )
+		{
+			threads[i]->join();
+			delete threads[i];
+		}
+
+		for ( std::size_t i = 0; i < workers.size(); ++i )
+		{
+			delete workers[i];
+		}
+
+		for ( std::size_t i = 0; i < roots.size(); ++i )
+		{
+			if ( at[i] == tree::npos )
+			{
+				tree* t = build(*roots[i]);
+
+				t->rules_hash = hash_rules(owners[i]->ignore_rules, owners[i]->gitignore);
+				delete owners[i]->data;
+				owners[i]->data = t;
+			}
+			else
+			{
+				// Append the directory's new contents
+				tree&            t     = *owners[i]->data;
+				const index_type first = static_cast< index_type >( t.name.size() );
+
+				t.clear_dir(at[i]);
+				build(t, at[i], *roots[i]);
+				t.extend_index(first);
+			}
+		}
+	}
+private:
+	/** The contents of one directory, while scanning
+	 */
+	struct listing
+	{
+		listing()
+			: old(0), from(0), name(0), metadata(false), rules(0), gitignore(false), read(false), mtime(-1), ctime(-1), device(0), base(0)
+		{
+		}
+
+		listing(
+			const tree* old_,
+			index_type  from_,
+			const char* name_,
+			bool        metadata_
+		)
+			: old(old_), from(from_), name(name_), metadata(metadata_), rules(0), gitignore(false), read(false), mtime(-1), ctime(-1), device(0), base(0)
+		{
+		}
+
+		/// Tree with the directory's previous contents, and its index there
+		const tree* old;
+		index_type  from;
+
+		const char* name;
+
+		/// Whether to record the metadata of files
+		bool metadata;
+
+		/// What to leave out of the directory, or null to keep everything.
+		/// Points to own_rules if the directory has a .gitignore file that
+		/// is followed, or to the parent's rules
+		const pbl::fs::IgnoreRules* rules;
+		pbl::fs::IgnoreRules        own_rules;
+		bool                        gitignore;
+
+		/// Path relative to the root, with a trailing "/". Only kept for rules
+		std::string path;
+
+		/// Whether the contents are known, and the times when they were read
+		bool               read;
+		long long          mtime;
+		long long          ctime;
+		unsigned long long device;
+
+		/// Names of subdirectories and files, as offsets from base
+		const char*               base;
+		std::vector< index_type > dirnames;
+		std::vector< index_type > filenames;
+
+		/// Names read from disk, if not taken from the old tree
+		std::string names;
+
+		/// Metadata for each of filenames, if recorded
+		std::vector< long long >          sizes;
+		std::vector< long long >          mtimes;
+		std::vector< unsigned long long > inodes;
+
+		/// One per subdirectory, or empty if they are not being scanned
+		std::vector< listing > children;
+	};
+
+	/** A directory whose subdirectories are still being scanned
+	 */
+	struct dir_ref
+	{
+		/// Descriptor for opening subdirectories, or -1 to use full paths
+		int fd;
+
+		/// Subdirectories that have not been opened yet. fd is closed at 0
+		std::size_t unopened;
+
+		/// Subdirectories that have not been finished. Deleted at 0
+		std::size_t refs;
+
+		dir_ref*    parent;
+		const char* name;
+	};
+
+	struct task
+	{
+		listing*    node;
+		dir_ref*    parent; // null for a directory added with add()
+		const char* path;   // for a directory added with add()
+		int         depth;
+	};
+
+	struct queue
+	{
+		cpp::mutex         m;
+		std::deque< task > tasks;
+	};
+
+	struct worker
+	{
+		worker(
+			scanner*    s_,
+			std::size_t id_
+		)
+			: s(s_), id(id_)
+		{
+		}
+
+		scanner*    s;
+		std::size_t id;
+	};
+
+	/** Orders names in a listing
+	 */
+	class name_less
+	{
+	public:
+		explicit name_less(const char* base_)
+			: base(base_)
+		{
+		}
+
+		bool operator()(
+			index_type a,
+			index_type b
+		) const
+		{
+			return std::strcmp(base + a, base + b) < 0;
+		}
+	private:
+		const char* base;
+	};
+
+	/** Directory reads mostly wait on the file system, so use more threads
+	 * than cores. High latency file systems benefit the most.
+	 */
+	static std::size_t thread_count()
+	{
+		const std::size_t n = 2 * static_cast< std::size_t >( cpp::thread::hardware_concurrency() );
+
+		return std::min(std::max(n, std::size_t(8) ), std::size_t(32) );
+	}
+
+	static void start(worker* w)
+	{
+		w->s->work(w->id);
+	}
+
+	void work(std::size_t id)
+	{
+		task t;
+
+		while ( take(id, t) )
+		{
+			scan(id, t);
+
+			cpp::lock_guard< cpp::mutex > lock(m);
+
+			if ( --pending == 0 )
+			{
+				// Everything has been scanned. Wake the others so they can exit
+				idle.notify_all();
+			}
+		}
+	}
+
+	/** Get the next directory to scan, waiting if others are still busy
+	 * @returns false when there is nothing left to do
+	 */
+	bool take(
+		std::size_t id,
+		task&       t
+	)
+	{
+		while ( true )
+		{
+			if ( pop(id, t) )
+			{
+				return true;
+			}
+
+			for ( std::size_t i = 1; i < queues.size(); ++i )
+			{
+				if ( steal( ( id + i ) % queues.size(), t ) )
+				{
+					return true;
+				}
+			}
+
+			cpp::unique_lock< cpp::mutex > lock(m);
+
+			while ( pending != 0 && available == 0 )
+			{
+				++sleeping;
+				idle.wait(lock);
+				--sleeping;
+			}
+
+			if ( pending == 0 )
+			{
+				return false;
+			}
+		}
+	}
+
+	void scan(
+		std::size_t id,
+		task&       t
+	)
+	{
+		listing& n = *t.node;
+
+		if ( t.depth >= maxdepth || cancel.cancelled() )
+		{
+			opened(t.parent);
+			release(t.parent);
+
+			return;
+		}
+
+		const bool known   = n.old && n.old->scanned[n.from] && ( n.old->metadata || !n.metadata );
+		const bool descend = t.depth + 1 < maxdepth;
+
+		// Only open a directory that was read before to check it, or to read its children
+		int fd = -1;
+
+		// Children might be read, and would need the rules of this directory's .gitignore
+		const bool need_rules = n.gitignore && known && descend && n.old->ndirs[n.from] != 0;
+
+		if ( !known || validate || need_rules || ( descend && has_unread_children(*n.old, n.from) ) )
+		{
+			fd = open_dir(t);
+		}
+
+		opened(t.parent);
+
+		long long          mtime  = -1;
+		long long          ctime  = -1;
+		unsigned long long device = 0;
+
+		if ( fd != -1 && ( !known || validate ) )
+		{
+			get_times(fd, mtime, ctime, device);
+		}
+
+		if ( fd != -1 && n.gitignore )
+		{
+			read_gitignore(n, fd);
+		}
+
+		// When validating, any change to the directory's metadata means it is read again
+		bool reuse = known && !( validate && ( mtime == -1 || mtime != n.old->mtime[n.from] || ctime != n.old->ctime[n.from] ) );
+
+		if ( reuse )
+		{
+			const tree& o = *n.old;
+
+			n.read  = true;
+			n.mtime = o.mtime[n.from];
+			n.ctime = o.ctime[n.from];
+			n.base  = o.names.data();
+			n.dirnames.reserve(o.ndirs[n.from]);
+
+			for ( std::size_t i = 0; i < o.ndirs[n.from]; ++i )
+			{
+				n.dirnames.push_back( o.name[o.subdir(n.from, i)] );
+			}
+
+			const std::size_t first = o.first_file[n.from];
+			const std::size_t last  = first + o.nfiles[n.from];
+
+			n.filenames.assign(o.files.begin() + first, o.files.begin() + last);
+
+			if ( n.metadata )
+			{
+				n.device = o.device[n.from];
+				n.sizes.assign(o.file_size.begin() + first, o.file_size.begin() + last);
+				n.mtimes.assign(o.file_mtime.begin() + first, o.file_mtime.begin() + last);
+				n.inodes.assign(o.file_inode.begin() + first, o.file_inode.begin() + last);
+
+				/* Writing to a file doesn't touch its directory, so the
+				 * recorded metadata is checked file by file. The directory
+				 * is read again if a file can't be found.
+				 */
+				if ( validate && !restat(n, fd) )
+				{
+					n.read = false;
+					n.base = 0;
+					n.dirnames.clear();
+					n.filenames.clear();
+					n.sizes.clear();
+					n.mtimes.clear();
+					n.inodes.clear();
+					reuse = false;
+				}
+			}
+		}
+
+		if ( !reuse && fd != -1 )
+		{
+			n.mtime  = mtime;
+			n.ctime  = ctime;
+			n.device = device;
+			read(n, fd);
+		}
+
+		if ( n.dirnames.empty() || !descend )
+		{
+			// Subdirectories are left unread
+			if ( fd != -1 )
+			{
+				::close(fd);
+			}
+
+			release(t.parent);
+
+			return;
+		}
+
+		n.children.resize( n.dirnames.size() );
+
+		for ( std::size_t i = 0, k = n.dirnames.size(); i < k; ++i )
+		{
+			n.children[i].name     = n.base + n.dirnames[i];
+			n.children[i].metadata = n.metadata;
+
+			if ( n.rules )
+			{
+				n.children[i].rules     = n.rules;
+				n.children[i].gitignore = n.gitignore;
+				n.children[i].path      = n.path + n.children[i].name + "/";
+			}
+
+			if ( reuse )
+			{
+				n.children[i].old  = n.old;
+				n.children[i].from = n.old->subdir(n.from, i);
+			}
+		}
+
+		if ( !reuse && known && validate )
+		{
+			// Subdirectories that are still here are checked on their own
+			match_children(n);
+		}
+
+		// Move down a level. This directory holds the parent's reference now
+		dir_ref* r = new dir_ref;
+
+		r->fd       = hold(fd);
+		r->unopened = n.children.size();
+		r->refs     = n.children.size();
+		r->parent   = t.parent;
+		r->name     = t.parent ? n.name : t.path;
+
+		for ( std::size_t i = 0, k = n.children.size(); i < k; ++i )
+		{
+			const task c = { &n.children[i], r, 0, t.depth + 1 };
+
+			push(id, c);
+		}
+	}
+
+	static bool has_unread_children(
+		const tree& o,
+		index_type  d
+	)
+	{
+		for ( std::size_t i = 0; i < o.ndirs[d]; ++i )
+		{
+			if ( !o.scanned[o.subdir(d, i)] )
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/** Find each subdirectory of a directory that was read again, in the old
+	 * tree
+	 */
+	static void match_children(listing& n)
+	{
+		const tree&       o    = *n.old;
+		const std::size_t nold = o.ndirs[n.from];
+
+		for ( std::size_t i = 0, j = 0; i < n.children.size() && j < nold;)
+		{
+			const index_type d = o.subdir(n.from, j);
+			const int        c = std::strcmp( n.children[i].name, o.name_of(d) );
+
+			if ( c == 0 )
+			{
+				n.children[i].old  = n.old;
+				n.children[i].from = d;
+			}
+
+			i += ( c <= 0 ) ? 1 : 0;
+			j += ( c >= 0 ) ? 1 : 0;
+		}
+	}
+
+	/** Refresh the metadata of files taken from the old tree, from the
+	 * open directory dirfd
+	 *
+	 * @returns false if a file is no longer a regular file
+	 */
+	static bool restat(
+		listing& n,
+		int      dirfd
+	)
+	{
+		if ( dirfd == -1 )
+		{
+			return false;
+		}
+
+		for ( std::size_t i = 0, k = n.filenames.size(); i < k; ++i )
+		{
+			struct stat st;
+
+			if ( ::fstatat(dirfd, n.base + n.filenames[i], &st, 0) != 0 || !S_ISREG(st.st_mode) )
+			{
+				return false;
+			}
+
+			const bool same_device = ( static_cast< unsigned long long >( st.st_dev ) == n.device );
+
+			n.sizes[i]  = static_cast< long long >( st.st_size );
+			n.mtimes[i] = mtime_ns(st);
+			n.inodes[i] = same_device ? static_cast< unsigned long long >( st.st_ino ) : 0;
+		}
+
+		return true;
+	}
+
+	/** Read a directory's contents, from the open directory dirfd
+	 */
+	static void read(
+		listing& n,
+		int      dirfd
+	)
+	{
+		const bool hidden_dirs  = false;
+		const bool hidden_files = false;
+
+		for ( cpp::filesystem::directory_iterator it(dirfd), last; it != last; ++it )
+		{
+			/* The type from the directory entry is free. Only stat when the
+			 * file system doesn't supply it, or to see what a symlink points
+			 * to, or to record a file's metadata.
+			 */
+			cpp::filesystem::file_status s( it.type() );
+
+			struct stat st;
+
+			const bool need_stat = s.type() == file_type::unknown || cpp::filesystem::is_symlink(s)
+			                       || ( n.metadata && !cpp::filesystem::is_directory(s) );
+
+			if ( need_stat )
+			{
+				if ( ::fstatat(dirfd, it.name(), &st, 0) != 0 )
+				{
+					// Ex., a broken symlink
+					continue;
+				}
+
+				s = cpp::filesystem::file_status( S_ISDIR(st.st_mode) ? file_type::directory
+				                                  : ( S_ISREG(st.st_mode) ? file_type::regular : file_type::unknown ) );
+			}
+
+			std::vector< index_type >* v = 0;
+
+			if ( cpp::filesystem::is_directory(s) )
+			{
+				if ( hidden_dirs || !is_hidden( it.name() ) )
+				{
+					v = &n.dirnames;
+				}
+			}
+			else if ( cpp::filesystem::is_regular_file(s) )
+			{
+				if ( hidden_files || !is_hidden( it.name() ) )
+				{
+					v = &n.filenames;
+				}
+			}
+
+			// Excluded directories are never opened
+			if ( v && n.rules && n.rules->excluded( n.path + it.name(), v == &n.dirnames ) )
+			{
+				v = 0;
+			}
+
+			if ( v )
+			{
+				if ( v == &n.filenames && n.metadata )
+				{
+					const bool same_device = ( static_cast< unsigned long long >( st.st_dev ) == n.device );
+
+					n.sizes.push_back( static_cast< long long >( st.st_size ) );
+					n.mtimes.push_back( mtime_ns(st) );
+					n.inodes.push_back( same_device ? static_cast< unsigned long long >( st.st_ino ) : 0 );
+				}
+
+				v->push_back( static_cast< index_type >( n.names.size() ) );
+				n.names.append( it.name() );
+				n.names.push_back('\0');
+			}
+		}
+
+		n.read = true;
+		n.base = n.names.data();
+		std::sort( n.dirnames.begin(), n.dirnames.end(), name_less(n.base) );
+
+		if ( !n.metadata )
+		{
+			std::sort( n.filenames.begin(), n.filenames.end(), name_less(n.base) );
+		}
+		else
+		{
+			/* Offsets were added in increasing order, so the metadata for
+			 * each one can be found again after sorting by name
+			 */
+			const std::vector< index_type >         unsorted(n.filenames);
+			const std::vector< long long >          sizes(n.sizes);
+			const std::vector< long long >          mtimes(n.mtimes);
+			const std::vector< unsigned long long > inodes(n.inodes);
+
+			std::sort( n.filenames.begin(), n.filenames.end(), name_less(n.base) );
+
+			for ( std::size_t i = 0; i < n.filenames.size(); ++i )
+			{
+				const std::size_t j = static_cast< std::size_t >( std::lower_bound(unsorted.begin(), unsorted.end(), n.filenames[i]) - unsorted.begin() );
+
+				n.sizes[i]  = sizes[j];
+				n.mtimes[i] = mtimes[j];
+				n.inodes[i] = inodes[j];
+			}
+		}
+	}
+
+	/** Follow the rules in a directory's .gitignore file, for the directory
+	 * and everything below it
+	 */
+	static void read_gitignore(
+		listing& n,
+		int      dirfd
+	)
+	{
+		const int fd = ::openat(dirfd, ".gitignore", O_RDONLY | O_CLOEXEC);
+
+		if ( fd == -1 )
+		{
+			return;
+		}
+
+		std::string text;
+		char        buf[4096];
+		ssize_t     k;
+
+		while ( ( k = ::read( fd, buf, sizeof( buf ) ) ) > 0 )
+		{
+			text.append( buf, static_cast< std::size_t >( k ) );
+		}
+
+		::close(fd);
+
+		pbl::fs::IgnoreRules r(n.rules, n.path);
+
+		r.add_lines(text);
+		n.own_rules.swap(r);
+		n.rules = &n.own_rules;
+	}
+
+	/** Get the rules that apply in a directory, by reading the .gitignore
+	 * files above it
+	 * @param chain The directory, then each of its parents below the root
+	 */
+	const pbl::fs::IgnoreRules* inherited_rules(
+		const DirectoryContents&         root,
+		const std::vector< index_type >& chain
+	)
+	{
+		const pbl::fs::IgnoreRules* rules = &root.ignore_rules;
+
+		if ( root.gitignore )
+		{
+			const tree& t = *root.data;
+			std::string path;
+
+			// The root, then each parent down to the directory's own
+			for ( std::size_t i = chain.size(); i > 0; --i )
+			{
+				ancestors.push_back( listing() );
+
+				listing& a = ancestors.back();
+
+				a.rules     = rules;
+				a.gitignore = true;
+				a.path      = path;
+
+				const int fd = ::open( ( t.name_of(0) + ( "/" + path ) ).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+
+				if ( fd != -1 )
+				{
+					read_gitignore(a, fd);
+					::close(fd);
+				}
+
+				rules = a.rules;
+				path += t.name_of(chain[i - 1]);
+				path += '/';
+			}
+		}
+
+		return rules;
+	}
+
+	/** Copy a root listing, and everything below it, into a new tree
+	 */
+	static tree* build(const listing& l)
+	{
+		std::size_t ndirs  = 1;
+		std::size_t nfiles = 0;
+		std::size_t nbytes = std::strlen(l.name) + 1;
+
+		count(l, ndirs, nfiles, nbytes);
+
+		tree* t = new tree;
+
+		t->names.reserve(nbytes);
+		t->name.reserve(ndirs);
+		t->parent.reserve(ndirs);
+		t->path_hash.reserve(ndirs);
+		t->first_dir.reserve(ndirs);
+		t->ndirs.reserve(ndirs);
+		t->first_file.reserve(ndirs);
+		t->nfiles.reserve(ndirs);
+		t->scanned.reserve(ndirs);
+		t->mtime.reserve(ndirs);
+		t->ctime.reserve(ndirs);
+		t->dirs.reserve(ndirs - 1);
+		t->files.reserve(nfiles);
+
+		if ( l.metadata )
+		{
+			t->metadata = true;
+			t->device.reserve(ndirs);
+			t->file_size.reserve(nfiles);
+			t->file_mtime.reserve(nfiles);
+			t->file_inode.reserve(nfiles);
+		}
+
+		t->add_dir(l.name, 0);
+		build(*t, 0, l);
+		t->build_index();
+
+		return t;
+	}
+
+	static void count(
+		const listing& l,
+		std::size_t&   ndirs,
+		std::size_t&   nfiles,
+		std::size_t&   nbytes
+	)
+	{
+		ndirs  += l.dirnames.size();
+		nfiles += l.filenames.size();
+
+		for ( std::size_t i = 0; i < l.dirnames.size(); ++i )
+		{
+			nbytes += std::strlen(l.base + l.dirnames[i]) + 1;
+		}
+
+		for ( std::size_t i = 0; i < l.filenames.size(); ++i )
+		{
+			nbytes += std::strlen(l.base + l.filenames[i]) + 1;
+		}
+
+		for ( std::size_t i = 0; i < l.children.size(); ++i )
+		{
+			count(l.children[i], ndirs, nfiles, nbytes);
+		}
+	}
+
+	static void build(
+		tree&          t,
+		index_type     id,
+		const listing& l
+	)
+	{
+		if ( !l.read )
+		{
+			return;
+		}
+
+		t.scanned[id]    = 1;
+		t.mtime[id]      = l.mtime;
+		t.ctime[id]      = l.ctime;
+		t.first_file[id] = static_cast< index_type >( t.files.size() );
+		t.nfiles[id]     = static_cast< index_type >( l.filenames.size() );
 
-#include "pbl/util/strings.h"
+		for ( std::size_t i = 0; i < l.filenames.size(); ++i )
+		{
+			t.files.push_back( t.add_name(l.base + l.filenames[i]) );
+		}
 
-namespace
-{
-bool is_hidden(const cpp::filesystem::path& p)
-{
-	const std::string s = p.filename().native();
+		if ( t.metadata )
+		{
+			t.device[id] = l.device;
+			t.file_size.insert( t.file_size.end(), l.sizes.begin(), l.sizes.end() );
+			t.file_mtime.insert( t.file_mtime.end(), l.mtimes.begin(), l.mtimes.end() );
+			t.file_inode.insert( t.file_inode.end(), l.inodes.begin(), l.inodes.end() );
+		}
 
-	return !s.empty() && s[0] == '.';
-}
+		// Subdirectories get consecutive indices
+		const index_type first = static_cast< index_type >( t.name.size() );
 
-bool is_absolute(const std::string& s)
-{
-	return !s.empty() && s[0] == '/';
-}
+		t.first_dir[id] = static_cast< index_type >( t.dirs.size() );
+		t.ndirs[id]     = static_cast< index_type >( l.dirnames.size() );
 
-}
+		for ( std::size_t i = 0; i < l.dirnames.size(); ++i )
+		{
+			t.dirs.push_back( t.add_dir(l.base + l.dirnames[i], id) );
+		}
 
-void DirectoryContents::swap(DirectoryContents& n)
-{
-	name_.swap(n.name_);
-	children.swap(n.children);
-	files.swap(n.files);
-}
+		for ( std::size_t i = 0; i < l.children.size(); ++i )
+		{
+			build(t, static_cast< index_type >( first + i ), l.children[i]);
+		}
+	}
 
-bool DirectoryContents::valid() const
-{
-	return !name_.empty();
-}
+	/** Open the directory for a task
+	 * @returns A descriptor, or -1 if the directory can't be opened
+	 */
+	static int open_dir(const task& t)
+	{
+		const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
 
-// Need to populate this directory's contents
-void DirectoryContents::init(const std::string& path)
-{
-	// Get all directories and children
-	std::vector< std::string > dirs;
-	std::vector< std::string > filenames;
+		if ( !t.parent )
+		{
+			return ::open(t.path, flags);
+		}
+
+		if ( t.parent->fd != -1 )
+		{
+			return ::openat(t.parent->fd, t.node->name, flags);
+		}
+
+		return ::open( ( full_path(t.parent) + "/" + t.node->name ).c_str(), flags );
+	}
+
+	static std::string full_path(const dir_ref* r)
+	{
+		return r->parent ? full_path(r->parent) + "/" + r->name : std::string(r->name);
+	}
+
+	/** Keep a directory open for its subdirectories, unless too many are
+	 * open already
+	 * @returns fd, or -1 if it was closed
+	 */
+	int hold(int fd)
+	{
+		if ( fd != -1 )
+		{
+			cpp::lock_guard< cpp::mutex > lock(m);
+
+			if ( held < max_held )
+			{
+				++held;
+
+				return fd;
+			}
+		}
+
+		if ( fd != -1 )
+		{
+			::close(fd);
+		}
+
+		return -1;
+	}
+
+	/** A subdirectory of r has been opened
+	 */
+	void opened(dir_ref* r)
+	{
+		if ( r )
+		{
+			int fd = -1;
+
+			{
+				cpp::lock_guard< cpp::mutex > lock(m);
+
+				if ( --r->unopened == 0 && r->fd != -1 )
+				{
+					fd    = r->fd;
+					r->fd = -1;
+					--held;
+				}
+			}
+
+			if ( fd != -1 )
+			{
+				::close(fd);
+			}
+		}
+	}
+
+	/** A subdirectory of r has been finished
+	 */
+	void release(dir_ref* r)
+	{
+		while ( r )
+		{
+			dir_ref* parent = 0;
+
+			{
+				cpp::lock_guard< cpp::mutex > lock(m);
+
+				if ( --r->refs != 0 )
+				{
+					return;
+				}
 
-	const bool hidden_dirs  = false;
-	const bool hidden_files = false;
+				parent = r->parent;
+			}
+
+			delete r;
+			r = parent;
+		}
+	}
 
-	for ( cpp::filesystem::directory_iterator it(path), last; it != last; ++it )
+	void push(
+		std::size_t id,
+		const task& t
+	)
 	{
-		cpp::filesystem::file_status s = it->status();
+		/* Count the task before it can be taken, so pending cannot drop to
+		 * zero while it is being scanned
+		 */
+		bool        wake  = false;
+		std::size_t spawn = 0;
 
-		if ( cpp::filesystem::is_directory(s) )
 		{
-			if ( hidden_dirs || !is_hidden( it->path() ) )
+			cpp::lock_guard< cpp::mutex > lock(m);
+
+			++pending;
+			++available;
+			wake = ( sleeping != 0 );
+
+			// The pushing thread takes one task itself. Start a thread for the others
+			if ( !wake && running && available > 1 && started < workers.size() )
 			{
-				const cpp::filesystem::path rel = it->path().lexically_relative(path);
-				dirs.push_back( rel.native() );
+				spawn = started++;
 			}
 		}
-		else if ( cpp::filesystem::is_regular_file(s) || cpp::filesystem::is_symlink(s) )
+
+		{
+			cpp::lock_guard< cpp::mutex > lock(queues[id]->m);
+
+			queues[id]->tasks.push_back(t);
+		}
+
+		if ( wake )
+		{
+			idle.notify_one();
+		}
+
+		if ( spawn != 0 )
+		{
+			cpp::thread* th = new cpp::thread(&scanner::start, workers[spawn]);
+
+			cpp::lock_guard< cpp::mutex > lock(m);
+
+			threads.push_back(th);
+		}
+	}
+
+	bool pop(
+		std::size_t id,
+		task&       t
+	)
+	{
 		{
-			if ( hidden_files || !is_hidden( it->path() ) )
+			cpp::lock_guard< cpp::mutex > lock(queues[id]->m);
+
+			if ( queues[id]->tasks.empty() )
 			{
-				const cpp::filesystem::path rel = it->path().lexically_relative(path);
-				filenames.push_back( rel.native() );
+				return false;
 			}
+
+			t = queues[id]->tasks.back();
+			queues[id]->tasks.pop_back();
 		}
+
+		taken();
+
+		return true;
 	}
 
-	// Save
-	std::sort( filenames.begin(), filenames.end() );
-	files.swap(filenames);
+	bool steal(
+		std::size_t victim,
+		task&       t
+	)
+	{
+		{
+			cpp::lock_guard< cpp::mutex > lock(queues[victim]->m);
+
+			if ( queues[victim]->tasks.empty() )
+			{
+				return false;
+			}
+
+			t = queues[victim]->tasks.front();
+			queues[victim]->tasks.pop_front();
+		}
+
+		taken();
 
-	std::sort( dirs.begin(), dirs.end() );
-	children.resize( dirs.size() );
+		return true;
+	}
 
-	for ( std::size_t i = 0, n = dirs.size(); i < n; ++i )
+	void taken()
 	{
-		children[i].name_.swap(dirs[i]);
+		cpp::lock_guard< cpp::mutex > lock(m);
+
+		--available;
 	}
-}
+
+	/// Most directory descriptors held open at once
+	static const std::size_t max_held = 256;
+
+	const int                     maxdepth;
+	const bool                    validate;
+	const pbl::cancellation_token cancel;
+
+	std::vector< queue* > queues;
+
+	/// Listings for the trees that were added, and the trees themselves
+	std::vector< listing* >           roots;
+	std::vector< DirectoryContents* > owners;
+
+	/// The directory each listing replaces, or npos for the whole tree
+	std::vector< index_type > at;
+
+	/// Full paths of the directories that replace only part of a tree
+	std::deque< std::string > paths;
+
+	/// The rules of their parents, from the .gitignore files above them
+	std::deque< listing > ancestors;
+
+	/// Number of tasks added with add()
+	std::size_t total_added;
+
+	/// One per queue. Worker 0 is the thread that called run()
+	std::vector< worker* > workers;
+
+	/// Protects the threads and counts, below
+	cpp::mutex              m;
+	cpp::condition_variable idle;
+
+	/// Threads started for workers other than 0
+	std::vector< cpp::thread* > threads;
+
+	/// Whether run() has been called, and the number of workers started
+	bool        running;
+	std::size_t started;
+
+	/// Tasks that have been queued, but not finished
+	std::size_t pending;
+
+	/// Tasks that are queued, and not taken by a thread
+	std::size_t available;
+
+	/// Threads waiting for work
+	std::size_t sleeping;
+
+	/// Number of directory descriptors held open for subdirectories
+	std::size_t held;
+};
 
 void DirectoryContents::change_depth()
 {
@@ -114,41 +1812,56 @@ void DirectoryContents::change_depth()
 
 void DirectoryContents::change_depth(int d)
 {
-	if ( name_.empty() )
-	{
-		children.clear();
-		files.clear();
-	}
-	else
+	if ( data )
 	{
-		change_depth(name_, 0, d);
+		scanner s(d);
+
+		s.add(this);
+		s.run();
 	}
 }
 
 void DirectoryContents::change_depth(
-	const std::string& current_path,
-	int                current_depth,
+	DirectoryContents& a,
+	DirectoryContents& b,
 	int                d
 )
 {
-	if ( current_depth < d )
+	scanner s(d);
+
+	if ( a.data )
 	{
-		if ( files.empty() && children.empty() )
-		{
-			init(current_path);
-		}
+		s.add(&a);
+	}
 
-		// Move down a level
-		for ( std::size_t i = 0, n = children.size(); i < n; ++i )
-		{
-			children[i].change_depth(current_path + "/" + children[i].name_, current_depth + 1, d);
-		}
+	if ( b.data )
+	{
+		s.add(&b);
 	}
-	else
+
+	s.run();
+}
+
+void DirectoryContents::validate(
+	DirectoryContents&             a,
+	DirectoryContents&             b,
+	int                            d,
+	const pbl::cancellation_token& cancel
+)
+{
+	scanner s(d, true, cancel);
+
+	if ( a.data )
 	{
-		children.clear();
-		files.clear();
+		s.add(&a);
 	}
+
+	if ( b.data )
+	{
+		s.add(&b);
+	}
+
+	s.run();
 }
 
 bool DirectoryContents::change_root(
@@ -156,14 +1869,8 @@ bool DirectoryContents::change_root(
 	int                d
 )
 {
-	if ( !dir.empty() )
+	if ( set_root(dir) )
 	{
-		name_ = ( is_absolute(dir) && cpp::filesystem::is_directory(dir) )
-		        ? cpp::filesystem::cleanpath(dir)
-				: std::string();
-		children.clear();
-		files.clear();
-
 		change_depth(d);
 
 		return true;
@@ -172,42 +1879,19 @@ bool DirectoryContents::change_root(
 	return false;
 }
 
-// dirname begins with current_path + "/"
-bool DirectoryContents::rescan(
-	const std::string& current_path,
-	const std::string& dirname,
-	int                depth,
-	int                maxdepth
-)
+bool DirectoryContents::set_root(const std::string& dir)
 {
-	/// @todo binary search because children is sorted
-	for ( std::size_t i = 0, n = children.size(); i < n; ++i )
+	if ( !dir.empty() )
 	{
-		const std::string s = current_path + "/" + children[i].name_;
+		clear();
 
-		if ( dirname == s )
+		if ( is_absolute(dir) && cpp::filesystem::is_directory(dir) )
 		{
-			// Found the dir
-			if ( cpp::filesystem::is_directory(s) )
-			{
-				children[i].children.clear();
-				children[i].files.clear();
-				children[i].change_depth(s, depth + 1, maxdepth);
-			}
-			else
-			{
-				// no longer exists on disk
-				children.erase(children.begin() + i);
-			}
-
-			return true;
+			data = new tree;
+			data->add_dir(cpp::filesystem::cleanpath(dir).c_str(), 0);
 		}
-		else if ( pbl::starts_with(dirname, s + "/") )
-		{
 
-			// Descend
-			return children[i].rescan(s, dirname, depth + 1, maxdepth);
-		}
+		return true;
 	}
 
 	return false;
@@ -218,55 +1902,279 @@ void DirectoryContents::rescan(
 	int                maxdepth
 )
 {
-	if ( !name_.empty() )
+	if ( !data )
 	{
-		if ( name_ == dirname )
+		return;
+	}
+
+	const std::string root = data->name_of(0);
+
+	if ( root == dirname )
+	{
+		// root has changed
+		if ( cpp::filesystem::is_directory(dirname) )
 		{
-			// root has changed
-			children.clear();
-			files.clear();
+			data->scanned[0] = 0;
+			change_depth(maxdepth);
+		}
+		else
+		{
+			// directory doesn't exist anymore
+			clear();
+		}
 
-			if ( cpp::filesystem::is_directory(dirname) )
+		return;
+	}
+
+	if ( !pbl::starts_with(dirname, root + "/") )
+	{
+		return;
+	}
+
+	const index_type d = data->find( dirname.substr(root.length() + 1) );
+
+	if ( d != tree::npos )
+	{
+		if ( cpp::filesystem::is_directory(dirname) )
+		{
+			if ( data->rules_hash == hash_rules(ignore_rules, gitignore) && ( data->metadata || !metadata ) )
 			{
-				change_depth(maxdepth);
+				// Only the directory, and everything below it, is read again
+				scanner s(maxdepth);
+
+				s.add(this, d);
+				s.run();
+
+				// Rebuild the tree once most of the arrays are what was dropped
+				if ( data->garbage > data->live() )
+				{
+					change_depth(maxdepth);
+				}
 			}
 			else
 			{
-				// directory doesn't exist anymore
-				name_.clear();
+				// The whole tree has to be read with the new settings
+				data->scanned[d] = 0;
+				change_depth(maxdepth);
 			}
 		}
 		else
 		{
-			if ( pbl::starts_with(dirname, name_ + "/") )
-			{
-				rescan(name_, dirname, 0, maxdepth);
-			}
+			// no longer exists on disk
+			data->remove(d);
 		}
 	}
 }
 
 std::size_t DirectoryContents::dircount() const
 {
-	return children.size();
+	return data ? data->ndirs[node] : 0;
 }
 
 std::size_t DirectoryContents::filecount() const
 {
-	return files.size();
+	return data ? data->nfiles[node] : 0;
+}
+
+DirectoryContents DirectoryContents::subdir(std::size_t i) const
+{
+	return DirectoryContents( data, data->subdir(node, i) );
+}
+
+std::string DirectoryContents::filename(std::size_t i) const
+{
+	return data->names.data() + data->files[data->first_file[node] + i];
+}
+
+long long DirectoryContents::filesize(std::size_t i) const
+{
+	return data->metadata ? data->file_size[data->first_file[node] + i] : -1;
+}
+
+bool DirectoryContents::fileidentity(
+	std::size_t             i,
+	pbl::fs::file_identity& id
+) const
+{
+	const std::size_t j = data->first_file[node] + i;
+
+	if ( !data->metadata || data->file_inode[j] == 0 )
+	{
+		return false;
+	}
+
+	id.device   = data->device[node];
+	id.inode    = data->file_inode[j];
+	id.size     = data->file_size[j];
+	id.mtime_ns = data->file_mtime[j];
+
+	return true;
+}
+
+void DirectoryContents::record_metadata(bool x)
+{
+	metadata = x;
+}
+
+void DirectoryContents::ignore(
+	const pbl::fs::IgnoreRules& rules,
+	bool                        gitignore_
+)
+{
+	ignore_rules = rules;
+	gitignore    = gitignore_;
 }
 
-const DirectoryContents& DirectoryContents::subdir(std::size_t i) const
+std::string DirectoryContents::name() const
 {
-	return children[i];
+	return data ? std::string( data->name_of(node) ) : std::string();
 }
 
-const std::string& DirectoryContents::filename(std::size_t i) const
+/* A snapshot is the magic, the counts, and then each of the tree's arrays
+ * in native byte order. The 8 byte arrays come first so every array is
+ * aligned in a mapped file.
+ */
+bool DirectoryContents::save(const std::string& filename) const
 {
-	return files[i];
+	if ( !data )
+	{
+		return false;
+	}
+
+	const tree& t = *data;
+
+	const std::string temp = filename + ".tmp";
+
+	std::FILE* file = std::fopen(temp.c_str(), "wb");
+
+	if ( !file )
+	{
+		return false;
+	}
+
+	const unsigned long long counts[snapshot_counts] = { t.name.size(), t.dirs.size(), t.files.size(), t.names.size(), t.metadata ? 1u : 0u, t.rules_hash };
+
+	bool ok = std::fwrite(snapshot_magic, sizeof( snapshot_magic ), 1, file) == 1
+	          && std::fwrite(counts, sizeof( counts ), 1, file) == 1
+	          && write_array(file, t.mtime)
+	          && write_array(file, t.ctime)
+	          && write_array(file, t.device)
+	          && write_array(file, t.file_size)
+	          && write_array(file, t.file_mtime)
+	          && write_array(file, t.file_inode)
+	          && write_array(file, t.name)
+	          && write_array(file, t.parent)
+	          && write_array(file, t.path_hash)
+	          && write_array(file, t.first_dir)
+	          && write_array(file, t.ndirs)
+	          && write_array(file, t.first_file)
+	          && write_array(file, t.nfiles)
+	          && write_array(file, t.dirs)
+	          && write_array(file, t.files)
+	          && write_array(file, t.scanned)
+	          && std::fwrite(t.names.data(), 1, t.names.size(), file) == t.names.size();
+
+	if ( std::fclose(file) != 0 )
+	{
+		ok = false;
+	}
+
+	if ( !ok || std::rename( temp.c_str(), filename.c_str() ) != 0 )
+	{
+		std::remove( temp.c_str() );
+
+		return false;
+	}
+
+	return true;
 }
 
-const std::string& DirectoryContents::name() const
+bool DirectoryContents::load(const std::string& filename)
 {
-	return name_;
+	if ( !data )
+	{
+		return false;
+	}
+
+	const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+
+	if ( fd == -1 )
+	{
+		return false;
+	}
+
+	struct stat st;
+	void*       p    = MAP_FAILED;
+	std::size_t size = 0;
+
+	if ( ::fstat(fd, &st) == 0 && st.st_size > 0 )
+	{
+		size = static_cast< std::size_t >( st.st_size );
+		p    = ::mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+
+	::close(fd);
+
+	if ( p == MAP_FAILED )
+	{
+		return false;
+	}
+
+	tree* t = new tree;
+
+	const char*               bytes  = static_cast< const char* >( p );
+	const std::size_t         head   = sizeof( snapshot_magic ) + snapshot_counts * sizeof( unsigned long long );
+	const unsigned long long* counts = reinterpret_cast< const unsigned long long* >( bytes + sizeof( snapshot_magic ) );
+
+	bool ok = size >= head && std::memcmp(bytes, snapshot_magic, sizeof( snapshot_magic ) ) == 0 && counts[0] != 0;
+
+	if ( ok )
+	{
+		const std::size_t ndirs  = static_cast< std::size_t >( counts[0] );
+		const std::size_t nfiles = static_cast< std::size_t >( counts[2] );
+		const std::size_t nmeta  = ( counts[4] != 0 ) ? 1 : 0;
+
+		snapshot_reader r(bytes + head, size - head);
+
+		t->metadata   = ( nmeta != 0 );
+		t->rules_hash = static_cast< unsigned >( counts[5] );
+
+		ok = r.read(t->mtime, ndirs)
+		     && r.read(t->ctime, ndirs)
+		     && r.read(t->device, nmeta * ndirs)
+		     && r.read(t->file_size, nmeta * nfiles)
+		     && r.read(t->file_mtime, nmeta * nfiles)
+		     && r.read(t->file_inode, nmeta * nfiles)
+		     && r.read(t->name, ndirs)
+		     && r.read(t->parent, ndirs)
+		     && r.read(t->path_hash, ndirs)
+		     && r.read(t->first_dir, ndirs)
+		     && r.read(t->ndirs, ndirs)
+		     && r.read(t->first_file, ndirs)
+		     && r.read(t->nfiles, ndirs)
+		     && r.read( t->dirs, static_cast< std::size_t >( counts[1] ) )
+		     && r.read(t->files, nfiles)
+		     && r.read(t->scanned, ndirs)
+		     && r.read( t->names, static_cast< std::size_t >( counts[3] ) )
+		     && r.at_end();
+	}
+
+	::munmap(p, size);
+
+	// Check that it is for this root and these rules, and that every index is in range
+	ok = ok && t->consistent() && std::strcmp( t->name_of(0), data->name_of(0) ) == 0
+	     && t->rules_hash == hash_rules(ignore_rules, gitignore);
+
+	if ( !ok )
+	{
+		delete t;
+
+		return false;
+	}
+
+	t->build_index();
+	delete data;
+	data = t;
+
+	return true;
 }
@@ -32,29 +32,126 @@
 #include <string>
 #include <vector>
 
+#include "pbl/util/cancellation.h"
+
+#include "hashcache.h"
+#include "ignorerules.h"
+
+/** A tree of directories and the (non-hidden) files in them
+ *
+ * The whole tree is stored flat: names are kept in a single arena, and each
+ * directory is a row in a set of parallel arrays that give its name, its
+ * parent, and the ranges of its subdirectories and files. Those ranges are
+ * sorted by name.
+ *
+ * A DirectoryContents made by the user owns a tree, and copies it when it is
+ * copied. The ones returned by subdir() are views into their owner's tree,
+ * and are only good until the owner is changed or destroyed.
+ */
 class DirectoryContents
 {
 public:
+	DirectoryContents();
+	DirectoryContents(const DirectoryContents&);
+	~DirectoryContents();
+
+	DirectoryContents& operator=(const DirectoryContents&);
+
 	void swap(DirectoryContents& n);
 
 	bool valid() const;
 	void change_depth();
 	void change_depth(int);
+
+	/** Scan two trees to the given depth at the same time
+	 */
+	static void change_depth(DirectoryContents&, DirectoryContents&, int);
+
+	/** Scan two trees to the given depth again, only reading directories
+	 * whose modification or status change time changed since they were
+	 * read
+	 *
+	 * If cancelled, the trees are left incomplete.
+	 */
+	static void validate(DirectoryContents&, DirectoryContents&, int, const pbl::cancellation_token& = pbl::cancellation_token());
+
 	bool change_root(const std::string&, int);
-	bool rescan(const std::string&, const std::string&, int, int);
+
+	/** Change the root directory, without scanning it
+	 *
+	 * Use change_depth to scan it.
+	 */
+	bool set_root(const std::string&);
 	void rescan(const std::string&, int);
 	std::size_t dircount() const;
 	std::size_t filecount() const;
-	const DirectoryContents& subdir(std::size_t) const;
-	const std::string& filename(std::size_t) const;
-	const std::string& name() const;
+	DirectoryContents subdir(std::size_t) const;
+	std::string filename(std::size_t) const;
+	std::string name() const;
+
+	/** Record the size, modification time and inode of files when scanning
+	 *
+	 * This costs a stat for every file. It takes effect when directories are
+	 * next scanned; ones that were read without it are read again.
+	 */
+	void record_metadata(bool);
+
+	/** Size of a file, as of when it was scanned
+	 * @returns -1 if metadata was not recorded
+	 */
+	long long filesize(std::size_t) const;
+
+	/** Identity of a file, as of when it was scanned
+	 * @returns false if metadata was not recorded, or the file is on another
+	 *   device than its directory
+	 */
+	bool fileidentity(std::size_t, pbl::fs::file_identity&) const;
+
+	/** Leave out files and directories that match the rules when scanning
+	 *
+	 * Excluded directories are not read at all. It takes effect when the tree
+	 * is next scanned; a tree that was scanned with other rules is read again.
+	 *
+	 * @param rules Rules without a parent
+	 * @param gitignore Also follow the .gitignore files found in the tree
+	 */
+	void ignore(const pbl::fs::IgnoreRules& rules, bool gitignore);
+
+	/** Write the tree to a snapshot file, which load() can map back in
+	 */
+	bool save(const std::string&) const;
+
+	/** Replace the tree with one from a snapshot file
+	 *
+	 * The snapshot must be for the same root. Use validate() to bring it up
+	 * to date.
+	 *
+	 * @returns false if the file is missing, damaged, or for another root
+	 */
+	bool load(const std::string&);
 private:
-	void init(const std::string&);
-	void change_depth(const std::string&, int, int);
+	class scanner;
+	friend class scanner;
+
+	struct tree;
+
+	/// Index of a directory, or of a name in the arena
+	typedef unsigned index_type;
+
+	DirectoryContents(tree*, index_type);
+
+	void clear();
+
+	tree*      data;
+	index_type node;
+	bool       owner;
+
+	/// Record metadata when scanning. Only used by the owner
+	bool metadata;
 
-	std::string                      name_;
-	std::vector< DirectoryContents > children;
-	std::vector< std::string >       files;
+	/// What to leave out when scanning. Only used by the owner
+	pbl::fs::IgnoreRules ignore_rules;
+	bool                 gitignore;
 };
 
 
@@ -0,0 +1,394 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "hashcache.h"
+
+#include <climits>
+#include <cstring>
+#include <cstdio>
+
+#include "pbl/config/os.h"
+
+#ifdef OS_POSIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+/// Identifies the file format
+const char magic[8] = { 'p', 'b', 'l', 'h', 'a', 's', 'h', '1' };
+
+/// device, inode, size, mtime, h1, h2
+const std::size_t record_fields = 6;
+
+typedef unsigned long long record_type[record_fields];
+
+void to_record(
+	const pbl::fs::file_identity& id,
+	const pbl::fs::content_hash&  h,
+	record_type&                  r
+)
+{
+	r[0] = id.device;
+	r[1] = id.inode;
+	r[2] = static_cast< unsigned long long >( id.size );
+	r[3] = static_cast< unsigned long long >( id.mtime_ns );
+	r[4] = h.h1;
+	r[5] = h.h2;
+}
+
+/// The smallest identity with the same device and inode
+pbl::fs::file_identity first_version(const pbl::fs::file_identity& id)
+{
+	const pbl::fs::file_identity f = { id.device, id.inode, LLONG_MIN, LLONG_MIN };
+
+	return f;
+}
+
+bool write_record(
+	std::FILE*                    file,
+	const pbl::fs::file_identity& id,
+	const pbl::fs::content_hash&  h
+)
+{
+	record_type r;
+
+	to_record(id, h, r);
+
+	return std::fwrite(r, sizeof( r ), 1, file) == 1;
+}
+
+/** Add a record to the end of the log
+ *
+ * Other processes may be appending to the same file. The log is opened for
+ * appending, and each record goes out in a single write, so records are
+ * never split or interleaved with theirs.
+ */
+bool append_record(
+	std::FILE*                    log,
+	const pbl::fs::file_identity& id,
+	const pbl::fs::content_hash&  h
+)
+{
+	record_type r;
+
+	to_record(id, h, r);
+
+	#ifdef OS_POSIX
+	return ::write(fileno(log), r, sizeof( r ) ) == static_cast< ssize_t >( sizeof( r ) );
+	#else
+	return std::fwrite(r, sizeof( r ), 1, log) == 1 && std::fflush(log) == 0;
+	#endif
+}
+
+}
+
+namespace pbl
+{
+namespace fs
+{
+bool operator==(
+	const file_identity& a,
+	const file_identity& b
+)
+{
+	return a.device == b.device && a.inode == b.inode && a.size == b.size && a.mtime_ns == b.mtime_ns;
+}
+
+bool operator<(
+	const file_identity& a,
+	const file_identity& b
+)
+{
+	if ( a.device != b.device )
+	{
+		return a.device < b.device;
+	}
+
+	if ( a.inode != b.inode )
+	{
+		return a.inode < b.inode;
+	}
+
+	if ( a.size != b.size )
+	{
+		return a.size < b.size;
+	}
+
+	return a.mtime_ns < b.mtime_ns;
+}
+
+bool get_identity(
+	const std::string& path,
+	file_identity&     id
+)
+{
+	#ifdef OS_POSIX
+	struct stat s;
+
+	if ( ::stat(path.c_str(), &s) == 0 && S_ISREG(s.st_mode) )
+	{
+		id.device = static_cast< unsigned long long >( s.st_dev );
+		id.inode  = static_cast< unsigned long long >( s.st_ino );
+		id.size   = static_cast< long long >( s.st_size );
+		#ifdef POSIX_ISSUE_7
+		id.mtime_ns = static_cast< long long >( s.st_mtim.tv_sec ) * 1000000000LL + static_cast< long long >( s.st_mtim.tv_nsec );
+		#else
+		id.mtime_ns = static_cast< long long >( s.st_mtime ) * 1000000000LL;
+		#endif
+
+		return true;
+	}
+
+	#endif // ifdef OS_POSIX
+
+	return false;
+}
+
+HashCache::HashCache()
+	: log(0)
+{
+}
+
+HashCache::~HashCache()
+{
+	close();
+}
+
+bool HashCache::open(const std::string& filename)
+{
+	close();
+
+	cpp::lock_guard< cpp::mutex > guard(lock);
+
+	entries.clear();
+
+	std::size_t records = 0;
+	bool        clean   = true;
+
+	if ( std::FILE* file = std::fopen(filename.c_str(), "rb") )
+	{
+		char header[sizeof( magic )];
+
+		if ( std::fread(header, sizeof( header ), 1, file) == 1 && std::memcmp(header, magic, sizeof( magic ) ) == 0 )
+		{
+			record_type r;
+
+			while ( std::fread(r, sizeof( r ), 1, file) == 1 )
+			{
+				const file_identity id = { r[0], r[1], static_cast< long long >( r[2] ), static_cast< long long >( r[3] ) };
+				const content_hash  h  = { r[4], r[5], id.size };
+
+				// Later entries replace earlier ones
+				entries[id] = h;
+				++records;
+			}
+
+			// A partial record at the end (ex., from a crash)
+			clean = ( std::feof(file) && !std::ferror(file) && std::ftell(file) == static_cast< long >( sizeof( magic ) + records * sizeof( record_type ) ) );
+		}
+		else
+		{
+			clean = false;
+		}
+
+		std::fclose(file);
+	}
+	else
+	{
+		clean = false;
+	}
+
+	prune();
+
+	// Start a fresh file if this one is damaged or mostly outdated
+	if ( !clean || records > 2 * entries.size() + 1024 )
+	{
+		if ( !rewrite(filename) )
+		{
+			return false;
+		}
+	}
+
+	log = std::fopen(filename.c_str(), "ab");
+
+	return log != 0;
+}
+
+bool HashCache::rewrite(const std::string& filename)
+{
+	const std::string temp = filename + ".tmp";
+
+	std::FILE* file = std::fopen(temp.c_str(), "wb");
+
+	if ( !file )
+	{
+		return false;
+	}
+
+	bool ok = std::fwrite(magic, sizeof( magic ), 1, file) == 1;
+
+	for ( std::map< file_identity, content_hash >::const_iterator it = entries.begin(); ok && it != entries.end(); ++it )
+	{
+		ok = write_record(file, it->first, it->second);
+	}
+
+	if ( std::fclose(file) != 0 )
+	{
+		ok = false;
+	}
+
+	if ( !ok || std::rename( temp.c_str(), filename.c_str() ) != 0 )
+	{
+		std::remove( temp.c_str() );
+
+		return false;
+	}
+
+	return true;
+}
+
+void HashCache::close()
+{
+	cpp::lock_guard< cpp::mutex > guard(lock);
+
+	if ( log )
+	{
+		std::fclose(log);
+		log = 0;
+	}
+}
+
+bool HashCache::is_open() const
+{
+	cpp::lock_guard< cpp::mutex > guard(lock);
+
+	return log != 0;
+}
+
+bool HashCache::find(
+	const file_identity& id,
+	content_hash&        h
+) const
+{
+	cpp::lock_guard< cpp::mutex > guard(lock);
+
+	std::map< file_identity, content_hash >::const_iterator it = entries.find(id);
+
+	if ( it != entries.end() )
+	{
+		h = it->second;
+
+		return true;
+	}
+
+	return false;
+}
+
+void HashCache::insert(
+	const file_identity& id,
+	const content_hash&  h
+)
+{
+	if ( h.size != id.size )
+	{
+		return;
+	}
+
+	cpp::lock_guard< cpp::mutex > guard(lock);
+
+	std::map< file_identity, content_hash >::iterator it = entries.find(id);
+
+	if ( it == entries.end() || it->second != h )
+	{
+		// The file's older versions won't be seen again
+		erase_older(id);
+		entries[id] = h;
+
+		if ( log )
+		{
+			append_record(log, id, h);
+		}
+	}
+}
+
+void HashCache::erase_older(const file_identity& id)
+{
+	std::map< file_identity, content_hash >::iterator it = entries.lower_bound(first_version(id) );
+
+	while ( it != entries.end() && it->first.device == id.device && it->first.inode == id.inode )
+	{
+		if ( it->first.mtime_ns < id.mtime_ns )
+		{
+			entries.erase(it++);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void HashCache::prune()
+{
+	std::map< file_identity, content_hash >::iterator it = entries.begin();
+
+	while ( it != entries.end() )
+	{
+		// Versions of one file are next to each other. Find the newest
+		std::map< file_identity, content_hash >::iterator last   = it;
+		std::map< file_identity, content_hash >::iterator newest = it;
+
+		for (; last != entries.end() && last->first.device == it->first.device && last->first.inode == it->first.inode; ++last )
+		{
+			if ( newest->first.mtime_ns < last->first.mtime_ns )
+			{
+				newest = last;
+			}
+		}
+
+		const file_identity keep = newest->first;
+
+		while ( it != last )
+		{
+			if ( it->first.mtime_ns < keep.mtime_ns )
+			{
+				entries.erase(it++);
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+}
+
+}
+}
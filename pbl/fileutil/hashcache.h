@@ -0,0 +1,126 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PBL_FILEUTIL_HASHCACHE_H
+#define PBL_FILEUTIL_HASHCACHE_H
+
+#include <cstdio>
+#include <map>
+#include <string>
+
+#include "cpp/mutex.h"
+
+#include "contenthash.h"
+
+namespace pbl
+{
+namespace fs
+{
+/** Identifies a particular version of a file
+ *
+ * If any of these change, the file's contents are assumed to have changed
+ */
+struct file_identity
+{
+	unsigned long long device;
+	unsigned long long inode;
+	long long          size;
+	long long          mtime_ns;
+};
+
+bool operator==(const file_identity&, const file_identity&);
+bool operator<(const file_identity&, const file_identity&);
+
+/** Get the identity of a regular file, following symlinks
+ * @returns false if the file could not be stat-ed or is not a regular file
+ */
+bool get_identity(const std::string&, file_identity&);
+
+/** A persistent map from file identity to content hash
+ *
+ * Entries are loaded when the cache is opened, and new entries are appended
+ * to the same file as they are inserted. Safe to use from several threads.
+ * Only the newest version of each file (by device and inode) is kept, so the
+ * cache grows with the number of files, not the number of changes.
+ *
+ * Several processes may share the file. Each entry is appended with a single
+ * write; entries a process appends after another one rewrote the file are
+ * lost, but the file stays whole.
+ */
+class HashCache
+{
+public:
+	HashCache();
+	~HashCache();
+
+	/** Load entries from the given file, and save new entries to it
+	 *
+	 * The file is created if it does not exist. It is rewritten if it contains
+	 * many outdated entries.
+	 */
+	bool open(const std::string&);
+
+	/** Write out pending entries and stop saving to the file
+	 */
+	void close();
+
+	bool is_open() const;
+
+	/** Look up the hash of a file's contents
+	 * @returns false if there is no entry for this version of the file
+	 */
+	bool find(const file_identity&, content_hash&) const;
+
+	/** Remember the hash of a file's contents
+	 *
+	 * Ignored if the hash does not cover the whole file
+	 */
+	void insert(const file_identity&, const content_hash&);
+private:
+	// non-copyable
+	HashCache(const HashCache&);
+	HashCache& operator=(const HashCache&);
+
+	bool rewrite(const std::string&);
+
+	/** Forget versions of the file that are older than this one
+	 */
+	void erase_older(const file_identity&);
+
+	/** Keep only the newest version of each file
+	 */
+	void prune();
+
+	mutable cpp::mutex                      lock;
+	std::map< file_identity, content_hash > entries;
+	std::FILE*                              log;
+};
+}
+}
+
+#endif // PBL_FILEUTIL_HASHCACHE_H
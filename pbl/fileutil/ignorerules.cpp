@@ -0,0 +1,381 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "ignorerules.h"
+
+#include <algorithm>
+
+namespace
+{
+/** Match a bracket expression at p, ex., "[a-z]" or "[!0-9]"
+ * @param next Set to just past the expression
+ * @returns false if there is no closing bracket, so "[" is an ordinary
+ *   character
+ */
+bool match_class(
+	const char*  p,
+	const char*  pe,
+	char         c,
+	const char*& next,
+	bool&        matched
+)
+{
+	const char* q = p + 1;
+
+	const bool negate = ( q != pe && ( *q == '!' || *q == '^' ) );
+
+	if ( negate )
+	{
+		++q;
+	}
+
+	bool found = false;
+
+	// A "]" straight after the "[" is part of the set
+	for ( const char* first = q; q != pe && ( *q != ']' || q == first ); ++q )
+	{
+		char lo = *q;
+
+		if ( lo == '\\' && q + 1 != pe )
+		{
+			lo = *++q;
+		}
+
+		char hi = lo;
+
+		if ( q + 2 < pe && q[1] == '-' && q[2] != ']' )
+		{
+			q += 2;
+			hi = *q;
+
+			if ( hi == '\\' && q + 1 != pe )
+			{
+				hi = *++q;
+			}
+		}
+
+		if ( lo <= c && c <= hi )
+		{
+			found = true;
+		}
+	}
+
+	if ( q == pe )
+	{
+		return false;
+	}
+
+	next    = q + 1;
+	matched = ( found != negate );
+
+	return true;
+}
+
+/** Match a glob against a path. Only "**" crosses a "/"
+ * @param pb Start of the whole pattern, to tell where a "**" is
+ */
+bool glob(
+	const char* pb,
+	const char* p,
+	const char* pe,
+	const char* s,
+	const char* se
+)
+{
+	while ( p != pe )
+	{
+		switch ( *p )
+		{
+		case '*':
+
+			if ( p + 1 != pe && p[1] == '*' && ( p == pb || p[-1] == '/' ) && ( p + 2 == pe || p[2] == '/' ) )
+			{
+				if ( p + 2 == pe )
+				{
+					// Trailing "**" matches everything inside
+					return true;
+				}
+
+				// "**/" matches zero or more directories
+				for ( const char* t = s;; ++t )
+				{
+					if ( glob(pb, p + 3, pe, t, se) )
+					{
+						return true;
+					}
+
+					t = std::find(t, se, '/');
+
+					if ( t == se )
+					{
+						return false;
+					}
+				}
+			}
+
+			for ( const char* t = s;; ++t )
+			{
+				if ( glob(pb, p + 1, pe, t, se) )
+				{
+					return true;
+				}
+
+				if ( t == se || *t == '/' )
+				{
+					return false;
+				}
+			}
+
+		case '?':
+
+			if ( s == se || *s == '/' )
+			{
+				return false;
+			}
+
+			++p;
+			++s;
+			break;
+		case '[':
+		{
+			const char* next    = 0;
+			bool        matched = false;
+
+			if ( s != se && *s != '/' && match_class(p, pe, *s, next, matched) )
+			{
+				if ( !matched )
+				{
+					return false;
+				}
+
+				p = next;
+				++s;
+				break;
+			}
+
+			// No closing bracket, or nothing to match
+			if ( s == se || *s != '[' )
+			{
+				return false;
+			}
+
+			++p;
+			++s;
+			break;
+		}
+		case '\\':
+
+			if ( p + 1 != pe )
+			{
+				++p;
+			}
+
+		// fall through
+		default:
+
+			if ( s == se || *s != *p )
+			{
+				return false;
+			}
+
+			++p;
+			++s;
+		}
+	}
+
+	return s == se;
+}
+
+unsigned fnv1a(
+	unsigned           h,
+	const std::string& s
+)
+{
+	for ( std::size_t i = 0; i < s.length(); ++i )
+	{
+		h = ( h ^ static_cast< unsigned char >( s[i] ) ) * 16777619u;
+	}
+
+	return h;
+}
+
+}
+
+namespace pbl
+{
+namespace fs
+{
+IgnoreRules::IgnoreRules(
+	const IgnoreRules* parent_,
+	const std::string& base_
+)
+	: parent(parent_), base(base_)
+{
+}
+
+void IgnoreRules::swap(IgnoreRules& r)
+{
+	std::swap(parent, r.parent);
+	base.swap(r.base);
+	rules.swap(r.rules);
+}
+
+void IgnoreRules::add(const std::string& line)
+{
+	std::string p = line;
+
+	if ( !p.empty() && p[p.length() - 1] == '\r' )
+	{
+		p.erase(p.length() - 1);
+	}
+
+	// Trailing spaces are dropped, unless escaped
+	while ( !p.empty() && p[p.length() - 1] == ' ' && !( p.length() >= 2 && p[p.length() - 2] == '\\' ) )
+	{
+		p.erase(p.length() - 1);
+	}
+
+	if ( p.empty() || p[0] == '#' )
+	{
+		return;
+	}
+
+	rule r = { std::string(), false, false, false };
+
+	if ( p[0] == '!' )
+	{
+		r.negate = true;
+		p.erase(0, 1);
+	}
+	else if ( p[0] == '\\' && p.length() >= 2 && ( p[1] == '!' || p[1] == '#' ) )
+	{
+		p.erase(0, 1);
+	}
+
+	if ( !p.empty() && p[p.length() - 1] == '/' )
+	{
+		r.dir_only = true;
+		p.erase(p.length() - 1);
+	}
+
+	r.anchored = ( p.find('/') != std::string::npos );
+
+	if ( !p.empty() && p[0] == '/' )
+	{
+		p.erase(0, 1);
+	}
+
+	if ( !p.empty() )
+	{
+		r.pattern = p;
+		rules.push_back(r);
+	}
+}
+
+void IgnoreRules::add_lines(const std::string& text)
+{
+	std::size_t i = 0;
+
+	while ( i < text.length() )
+	{
+		std::size_t j = text.find('\n', i);
+
+		if ( j == std::string::npos )
+		{
+			j = text.length();
+		}
+
+		add( text.substr(i, j - i) );
+		i = j + 1;
+	}
+}
+
+bool IgnoreRules::excluded(
+	const std::string& path,
+	bool               is_dir
+) const
+{
+	return match(path, is_dir) == 1;
+}
+
+bool IgnoreRules::empty() const
+{
+	return rules.empty() && ( !parent || parent->empty() );
+}
+
+unsigned IgnoreRules::fingerprint() const
+{
+	unsigned h = parent ? parent->fingerprint() : 2166136261u;
+
+	h = fnv1a(h, base);
+
+	for ( std::size_t i = 0; i < rules.size(); ++i )
+	{
+		const char flags[2] = { '\n', static_cast< char >( ( rules[i].negate ? 1 : 0 ) | ( rules[i].dir_only ? 2 : 0 ) | ( rules[i].anchored ? 4 : 0 ) ) };
+
+		h = fnv1a( h, std::string(flags, 2) );
+		h = fnv1a(h, rules[i].pattern);
+	}
+
+	return h;
+}
+
+int IgnoreRules::match(
+	const std::string& path,
+	bool               is_dir
+) const
+{
+	if ( path.compare(0, base.length(), base) == 0 )
+	{
+		const char*       s    = path.data() + base.length();
+		const char*       se   = path.data() + path.length();
+		const std::size_t last = path.rfind('/');
+		const char*       name = ( last == std::string::npos || last < base.length() ) ? s : path.data() + last + 1;
+
+		for ( std::size_t i = rules.size(); i > 0; --i )
+		{
+			const rule& r = rules[i - 1];
+
+			if ( !r.dir_only || is_dir )
+			{
+				const char* pb = r.pattern.data();
+				const char* pe = pb + r.pattern.length();
+
+				if ( glob(pb, pb, pe, r.anchored ? s : name, se) )
+				{
+					return r.negate ? 0 : 1;
+				}
+			}
+		}
+	}
+
+	return parent ? parent->match(path, is_dir) : -1;
+}
+
+}
+}
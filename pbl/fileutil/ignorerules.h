@@ -0,0 +1,104 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PBL_FILEUTIL_IGNORERULES_H
+#define PBL_FILEUTIL_IGNORERULES_H
+
+#include <string>
+#include <vector>
+
+namespace pbl
+{
+namespace fs
+{
+/** Patterns for files and directories to leave out, as in a .gitignore file
+ *
+ * A pattern without a slash matches a name at any depth. One with a slash is
+ * relative to the base directory of the rules. A trailing slash only matches
+ * directories, and a leading "!" includes what an earlier pattern excluded.
+ * "*", "?", "[...]" and "**" work as they do for git. The last pattern that
+ * matches wins, and rules override the rules of their parent.
+ */
+class IgnoreRules
+{
+public:
+	/**
+	 * @param parent Rules from further up the tree. May be null. Must outlive
+	 *   these rules
+	 * @param base The directory the patterns are relative to, as a path
+	 *   relative to the root of the scan with a trailing "/", or empty for the
+	 *   root itself
+	 */
+	explicit IgnoreRules(const IgnoreRules* parent = 0, const std::string& base = std::string());
+
+	void swap(IgnoreRules&);
+
+	/** Add a pattern. Blank lines and comments are skipped
+	 */
+	void add(const std::string&);
+
+	/** Add each line of a .gitignore file
+	 */
+	void add_lines(const std::string&);
+
+	/** Check if a path should be left out
+	 * @param path Relative to the root of the scan, without a trailing "/"
+	 * @param is_dir Whether the path is a directory
+	 */
+	bool excluded(const std::string& path, bool is_dir) const;
+
+	/** Check if there are no patterns, here or in a parent
+	 */
+	bool empty() const;
+
+	/** Hash of the patterns, here and in parents, ex., to tell if something
+	 * was scanned with the same rules
+	 */
+	unsigned fingerprint() const;
+private:
+	struct rule
+	{
+		std::string pattern;
+		bool        negate;   // include instead of exclude
+		bool        dir_only; // had a trailing slash
+		bool        anchored; // had a slash, so matches from the base
+	};
+
+	/** Find the last pattern that matches, here or in a parent
+	 * @returns 1 if excluded, 0 if included, -1 if nothing matched
+	 */
+	int match(const std::string& path, bool is_dir) const;
+
+	const IgnoreRules*  parent;
+	std::string         base;
+	std::vector< rule > rules;
+};
+}
+}
+
+#endif // PBL_FILEUTIL_IGNORERULES_H
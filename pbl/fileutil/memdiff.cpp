@@ -0,0 +1,225 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "memdiff.h"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#include <immintrin.h>
+#define PBL_FS_MEMDIFF_X86
+#endif
+
+namespace
+{
+typedef std::size_t (* kernel_type)(const unsigned char*, const unsigned char*, std::size_t);
+
+std::size_t first_difference_bytes(
+	const unsigned char* a,
+	const unsigned char* b,
+	std::size_t          n
+)
+{
+	std::size_t i = 0;
+
+	while ( i < n && a[i] == b[i] )
+	{
+		++i;
+	}
+
+	return i;
+}
+
+#ifdef PBL_FS_MEMDIFF_X86
+__attribute__( ( target("sse2") ) )
+std::size_t first_difference_sse2(
+	const unsigned char* a,
+	const unsigned char* b,
+	std::size_t          n
+)
+{
+	std::size_t i = 0;
+
+	for (; i + 16 <= n; i += 16 )
+	{
+		const __m128i x = _mm_loadu_si128( reinterpret_cast< const __m128i* >( a + i ) );
+		const __m128i y = _mm_loadu_si128( reinterpret_cast< const __m128i* >( b + i ) );
+
+		const unsigned mask = static_cast< unsigned >( _mm_movemask_epi8( _mm_cmpeq_epi8(x, y) ) );
+
+		if ( mask != 0xFFFFu )
+		{
+			return i + static_cast< std::size_t >( __builtin_ctz(~mask) );
+		}
+	}
+
+	return i + first_difference_bytes(a + i, b + i, n - i);
+}
+
+__attribute__( ( target("avx2") ) )
+std::size_t first_difference_avx2(
+	const unsigned char* a,
+	const unsigned char* b,
+	std::size_t          n
+)
+{
+	std::size_t i = 0;
+
+	// Two vectors per iteration. Only look for the byte once something differs
+	for (; i + 64 <= n; i += 64 )
+	{
+		const __m256i x0 = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( a + i ) );
+		const __m256i y0 = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( b + i ) );
+		const __m256i x1 = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( a + i + 32 ) );
+		const __m256i y1 = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( b + i + 32 ) );
+
+		const __m256i e0 = _mm256_cmpeq_epi8(x0, y0);
+		const __m256i e1 = _mm256_cmpeq_epi8(x1, y1);
+
+		if ( static_cast< unsigned >( _mm256_movemask_epi8( _mm256_and_si256(e0, e1) ) ) != 0xFFFFFFFFu )
+		{
+			const unsigned m0 = static_cast< unsigned >( _mm256_movemask_epi8(e0) );
+
+			if ( m0 != 0xFFFFFFFFu )
+			{
+				return i + static_cast< std::size_t >( __builtin_ctz(~m0) );
+			}
+
+			const unsigned m1 = static_cast< unsigned >( _mm256_movemask_epi8(e1) );
+
+			return i + 32 + static_cast< std::size_t >( __builtin_ctz(~m1) );
+		}
+	}
+
+	for (; i + 32 <= n; i += 32 )
+	{
+		const __m256i x = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( a + i ) );
+		const __m256i y = _mm256_loadu_si256( reinterpret_cast< const __m256i* >( b + i ) );
+
+		const unsigned mask = static_cast< unsigned >( _mm256_movemask_epi8( _mm256_cmpeq_epi8(x, y) ) );
+
+		if ( mask != 0xFFFFFFFFu )
+		{
+			return i + static_cast< std::size_t >( __builtin_ctz(~mask) );
+		}
+	}
+
+	return i + first_difference_bytes(a + i, b + i, n - i);
+}
+
+#if defined( __x86_64__ )
+__attribute__( ( target("avx512f,avx512bw") ) )
+std::size_t first_difference_avx512(
+	const unsigned char* a,
+	const unsigned char* b,
+	std::size_t          n
+)
+{
+	std::size_t i = 0;
+
+	for (; i + 64 <= n; i += 64 )
+	{
+		const __m512i x = _mm512_loadu_si512(a + i);
+		const __m512i y = _mm512_loadu_si512(b + i);
+
+		const unsigned long long mask = _mm512_cmpneq_epi8_mask(x, y);
+
+		if ( mask != 0 )
+		{
+			return i + static_cast< std::size_t >( __builtin_ctzll(mask) );
+		}
+	}
+
+	if ( i < n )
+	{
+		// Masked loads don't touch memory past the end of the blocks
+		const __mmask64 tail = _cvtu64_mask64( ( 1ULL << ( n - i ) ) - 1 );
+
+		const __m512i x = _mm512_maskz_loadu_epi8(tail, a + i);
+		const __m512i y = _mm512_maskz_loadu_epi8(tail, b + i);
+
+		const unsigned long long mask = _mm512_cmpneq_epi8_mask(x, y);
+
+		if ( mask != 0 )
+		{
+			return i + static_cast< std::size_t >( __builtin_ctzll(mask) );
+		}
+	}
+
+	return n;
+}
+
+#endif // if defined( __x86_64__ )
+#endif // ifdef PBL_FS_MEMDIFF_X86
+
+kernel_type select_kernel()
+{
+	#ifdef PBL_FS_MEMDIFF_X86
+	__builtin_cpu_init();
+
+	#if defined( __x86_64__ )
+
+	if ( __builtin_cpu_supports("avx512bw") )
+	{
+		return first_difference_avx512;
+	}
+
+	#endif
+
+	if ( __builtin_cpu_supports("avx2") )
+	{
+		return first_difference_avx2;
+	}
+
+	if ( __builtin_cpu_supports("sse2") )
+	{
+		return first_difference_sse2;
+	}
+
+	#endif // ifdef PBL_FS_MEMDIFF_X86
+
+	return first_difference_bytes;
+}
+
+}
+
+namespace pbl
+{
+namespace fs
+{
+std::size_t first_difference(
+	const void* a,
+	const void* b,
+	std::size_t n
+)
+{
+	static const kernel_type kernel = select_kernel();
+
+	return kernel(static_cast< const unsigned char* >( a ), static_cast< const unsigned char* >( b ), n);
+}
+
+}
+}
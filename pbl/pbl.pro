@@ -23,19 +23,30 @@ SOURCES += \
     process/detach.cpp \
     util/strings.cpp \
     fileutil/compare.cpp \
+    fileutil/memdiff.cpp \
+    fileutil/contenthash.cpp \
+    fileutil/hashcache.cpp \
+    fileutil/asyncreader.cpp \
     process/which.cpp \
     fileutil/directorycontents.cpp \
-    fileutil/reduce_paths.cpp
+    fileutil/reduce_paths.cpp \
+    fileutil/ignorerules.cpp
 
 HEADERS += \
     process/detach.h \
     util/strings.h \
     fileutil/compare.h \
+    fileutil/memdiff.h \
+    fileutil/contenthash.h \
+    fileutil/hashcache.h \
+    fileutil/asyncreader.h \
     process/which.h \
     config/os.h \
     fileutil/directorycontents.h \
     util/return_code.h \
-    fileutil/reduce_paths.h
+    util/cancellation.h \
+    fileutil/reduce_paths.h \
+    fileutil/ignorerules.h
 
 unix {
     target.path = /usr/lib
@@ -0,0 +1,116 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PBL_UTIL_CANCELLATION_H
+#define PBL_UTIL_CANCELLATION_H
+
+namespace pbl
+{
+class cancellation_token;
+
+/** Cancels long running operations from another thread
+ *
+ * Each call to cancel() starts a new generation. Tokens handed out before
+ * the call report that they have been cancelled; tokens handed out after
+ * it do not.
+ */
+class cancellation_source
+{
+public:
+	cancellation_source()
+		: generation(0)
+	{
+	}
+
+	/** Cancel every token issued so far
+	 */
+	void cancel()
+	{
+		#if defined( __GNUC__ )
+		__atomic_add_fetch(&generation, 1, __ATOMIC_RELEASE);
+		#else
+		++generation;
+		#endif
+	}
+
+	cancellation_token token() const;
+private:
+	friend class cancellation_token;
+
+	unsigned long current() const
+	{
+		#if defined( __GNUC__ )
+		return __atomic_load_n(&generation, __ATOMIC_ACQUIRE);
+		#else
+		return generation;
+		#endif
+	}
+
+	volatile unsigned long generation;
+};
+
+/** Checked by an operation, between steps, to see if it should give up
+ *
+ * A default constructed token is never cancelled. The source must outlive
+ * its tokens.
+ */
+class cancellation_token
+{
+public:
+	cancellation_token()
+		: source(0), generation(0)
+	{
+	}
+
+	bool cancelled() const
+	{
+		return source && source->current() != generation;
+	}
+private:
+	friend class cancellation_source;
+
+	cancellation_token(
+		const cancellation_source* source_,
+		unsigned long              generation_
+	)
+		: source(source_), generation(generation_)
+	{
+	}
+
+	const cancellation_source* source;
+	unsigned long              generation;
+};
+
+inline cancellation_token cancellation_source::token() const
+{
+	return cancellation_token( this, current() );
+}
+
+}
+
+#endif // PBL_UTIL_CANCELLATION_H
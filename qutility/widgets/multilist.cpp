@@ -123,6 +123,8 @@ void MultiList::sync_scroll(int val)
 	{
 		verticalScrollBar->setValue(val);
 	}
+
+	emit viewportChanged();
 }
 
 void MultiList::update_selection()
@@ -138,6 +140,8 @@ void MultiList::update_selection()
 				connect(dirs[i], &QListWidget::itemSelectionChanged, this, &MultiList::update_selection);
 			}
 		}
+
+		emit selectionChanged();
 	}
 }
 
@@ -201,6 +205,8 @@ void MultiList::update_scroll_range(
 )
 {
 	verticalScrollBar->setRange(min, max);
+
+	emit viewportChanged();
 }
 
 void MultiList::clearText(
@@ -217,6 +223,21 @@ void MultiList::clearText(
 	}
 }
 
+void MultiList::setText(
+	int            col,
+	int            row,
+	const QString& text
+)
+{
+	if ( col >= 0 && static_cast< unsigned >( col ) < dirs.size() )
+	{
+		if ( QListWidgetItem* item = dirs[col]->item(row) )
+		{
+			item->setText(text);
+		}
+	}
+}
+
 void MultiList::removeItem(int r)
 {
 	for ( std::size_t i = 0; i < dirs.size(); ++i )
@@ -244,14 +265,16 @@ void MultiList::style(
 	bool ignored,
 	bool unmatched,
 	bool compared,
-	bool same
+	bool same,
+	bool provisional,
+	bool moved
 )
 {
 	for ( std::size_t i = 0; i < dirs.size(); ++i )
 	{
 		if ( QListWidgetItem* item = dirs[i]->item(r) )
 		{
-			styleitem(item, ignored, unmatched, compared, same);
+			styleitem(item, ignored, unmatched, compared, same, provisional, moved);
 		}
 	}
 }
@@ -270,29 +293,48 @@ void MultiList::setRowHidden(
 	}
 }
 
+bool MultiList::isRowHidden(int r) const
+{
+	if ( !dirs.empty() )
+	{
+		if ( QListWidgetItem* item = dirs[0]->item(r) )
+		{
+			return item->isHidden();
+		}
+	}
+
+	return false;
+}
+
 void MultiList::styleitem(
 	QListWidgetItem* item,
 	bool             ignore_,
 	bool             unmatched_,
 	bool             compared_,
-	bool             same_
+	bool             same_,
+	bool             provisional_,
+	bool             moved_
 )
 {
-	// strike out ignored items
+	// strike out ignored items, and slant results that are only a guess
 	QFont f = item->font();
 
 	f.setStrikeOut(ignore_);
-	f.setItalic(ignore_);
+	f.setItalic(ignore_ || provisional_);
 	item->setFont(f);
 
 	// set font colour
 	QColor font_colour = Qt::gray;
 
-	// green for unmatched items
+	// green for unmatched items, blue for items matched by their contents
 	if ( unmatched_ )
 	{
 		font_colour = QColor(0x40, 0xA0, 0x40);
 	}
+	else if ( moved_ )
+	{
+		font_colour = QColor(0x40, 0x60, 0xC0);
+	}
 	else
 	{
 		// matched items are gray for uncompared, black for the same, red for different
@@ -327,6 +369,42 @@ int MultiList::currentRow() const
 	return -1;
 }
 
+bool MultiList::isRowSelected(int r) const
+{
+	if ( !dirs.empty() )
+	{
+		if ( QListWidgetItem* item = dirs[0]->item(r) )
+		{
+			return item->isSelected();
+		}
+	}
+
+	return false;
+}
+
+void MultiList::visibleRows(
+	int& first,
+	int& last
+) const
+{
+	first = 0;
+	last  = -1;
+
+	if ( !dirs.empty() )
+	{
+		QListWidget* dir = dirs[0];
+
+		if ( const int n = dir->count() )
+		{
+			QListWidgetItem* top    = dir->itemAt(0, 0);
+			QListWidgetItem* bottom = dir->itemAt(0, dir->viewport()->height() - 1);
+
+			first = top ? dir->row(top) : 0;
+			last  = bottom ? dir->row(bottom) : n - 1;
+		}
+	}
+}
+
 QList< int > MultiList::selectedRows() const
 {
 	QList< int > l;
@@ -57,12 +57,26 @@ public:
 
 	void clearText(int col, int row);
 
-	void style(int, bool, bool, bool, bool);
+	void setText(int col, int row, const QString&);
+
+	/** Set the font of a row
+	 * @param provisional The result is a guess that has yet to be checked
+	 * @param moved The items have different names, but the same contents
+	 */
+	void style(int, bool, bool, bool, bool, bool, bool);
 
 	int currentRow() const;
 
 	QList< int > selectedRows() const;
 
+	bool isRowSelected(int) const;
+
+	/** Get the range of rows that are (at least partly) on screen
+	 *
+	 * last is less than first if there are no rows.
+	 */
+	void visibleRows(int& first, int& last) const;
+
 	void setSelectedRows(const QList< int >&);
 
 	/** Deselect all items
@@ -70,8 +84,18 @@ public:
 	void clearSelection();
 
 	void setRowHidden(int, bool);
+
+	bool isRowHidden(int) const;
 signals:
 	void itemActivated(int);
+
+	/** The list was scrolled or resized, changing the visibleRows()
+	 */
+	void viewportChanged();
+
+	/** The user changed the selected rows
+	 */
+	void selectionChanged();
 private slots:
 	void handle_item_double_clicked(QListWidgetItem*);
 
@@ -83,7 +107,7 @@ private slots:
 	void current_row_changed(int);
 	void update_scroll_range(int, int);
 private:
-	void styleitem(QListWidgetItem*, bool, bool, bool, bool);
+	void styleitem(QListWidgetItem*, bool, bool, bool, bool, bool, bool);
 
 
 	std::vector< QListWidget* > dirs;
@@ -0,0 +1,153 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "comparescheduler.h"
+
+CompareScheduler::CompareScheduler()
+	: live(0), next_stamp(1)
+{
+}
+
+bool CompareScheduler::entry::operator<(const entry& e) const
+{
+	if ( t != e.t )
+	{
+		return t > e.t;
+	}
+
+	if ( cost != e.cost )
+	{
+		return cost > e.cost;
+	}
+
+	return row > e.row;
+}
+
+void CompareScheduler::reset(std::size_t nrows)
+{
+	heap = std::priority_queue< entry >();
+	stamps.assign(nrows, 0);
+	live = 0;
+}
+
+void CompareScheduler::schedule(
+	std::size_t row,
+	tier        t,
+	long long   cost
+)
+{
+	if ( row >= stamps.size() )
+	{
+		stamps.resize(row + 1, 0);
+	}
+
+	if ( stamps[row] == 0 )
+	{
+		++live;
+	}
+
+	const entry e = { t, cost, row, next_stamp++ };
+
+	stamps[row] = e.stamp;
+	heap.push(e);
+
+	compact();
+}
+
+void CompareScheduler::cancel(std::size_t row)
+{
+	if ( row < stamps.size() && stamps[row] != 0 )
+	{
+		stamps[row] = 0;
+		--live;
+	}
+}
+
+bool CompareScheduler::top(std::size_t& row)
+{
+	skip_stale();
+
+	if ( heap.empty() )
+	{
+		return false;
+	}
+
+	row = heap.top().row;
+
+	return true;
+}
+
+void CompareScheduler::pop()
+{
+	skip_stale();
+
+	if ( !heap.empty() )
+	{
+		cancel( heap.top().row );
+		heap.pop();
+	}
+}
+
+void CompareScheduler::skip_stale()
+{
+	while ( !heap.empty() )
+	{
+		const entry& e = heap.top();
+
+		if ( e.row < stamps.size() && stamps[e.row] == e.stamp )
+		{
+			break;
+		}
+
+		heap.pop();
+	}
+}
+
+void CompareScheduler::compact()
+{
+	if ( heap.size() > 2 * live + 1024 )
+	{
+		std::vector< entry > current;
+
+		current.reserve(live);
+
+		while ( !heap.empty() )
+		{
+			const entry& e = heap.top();
+
+			if ( e.row < stamps.size() && stamps[e.row] == e.stamp )
+			{
+				current.push_back(e);
+			}
+
+			heap.pop();
+		}
+
+		heap = std::priority_queue< entry >( current.begin(), current.end() );
+	}
+}
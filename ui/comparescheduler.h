@@ -0,0 +1,111 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef COMPARESCHEDULER_H
+#define COMPARESCHEDULER_H
+
+#include <cstddef>
+#include <queue>
+#include <vector>
+
+/** Decides which row of the comparison list to compare next
+ *
+ * Rows are ordered by tier, then by estimated cost (cheapest first), then by
+ * position. A row can be rescheduled at any time, ex., when it scrolls into
+ * view; the old entry is left in the heap and skipped when it reaches the
+ * top.
+ */
+class CompareScheduler
+{
+public:
+	/// How much the user wants to see a row's result. Lower is sooner
+	enum tier
+	{
+		TIER_SELECTED,
+		TIER_ONSCREEN,
+		TIER_SHOWN,
+		TIER_HIDDEN,
+		TIER_VERIFY    // checking a result that was guessed from metadata
+	};
+
+	CompareScheduler();
+
+	/** Forget all rows, ex., because rows were added or removed
+	 * @param nrows Number of rows in the list
+	 */
+	void reset(std::size_t nrows);
+
+	/** Schedule a row, or change its priority if it is already scheduled
+	 * @param cost Estimated cost of comparing the row (ex., file size)
+	 */
+	void schedule(std::size_t row, tier, long long cost);
+
+	/** Stop considering a row
+	 */
+	void cancel(std::size_t row);
+
+	/** Get the row that should be compared next
+	 * @returns false if no rows are scheduled
+	 */
+	bool top(std::size_t& row);
+
+	/** Remove the row returned by top()
+	 */
+	void pop();
+private:
+	struct entry
+	{
+		tier               t;
+		long long          cost;
+		std::size_t        row;
+		unsigned long long stamp;
+
+		// "less than" means "compared later", for std::priority_queue
+		bool operator<(const entry&) const;
+	};
+
+	/** Drop stale entries from the top of the heap
+	 */
+	void skip_stale();
+
+	/** Rebuild the heap from current entries, if it is mostly stale ones
+	 */
+	void compact();
+
+	std::priority_queue< entry > heap;
+
+	/// The stamp of each row's current entry, or 0 if not scheduled
+	std::vector< unsigned long long > stamps;
+
+	/// Number of rows that are scheduled
+	std::size_t live;
+
+	unsigned long long next_stamp;
+};
+
+#endif // COMPARESCHEDULER_H
@@ -28,82 +28,59 @@
  */
 #include "comparisonlist.h"
 
-#include <algorithm>
-
 #include "pbl/fileutil/directorycontents.h"
 
 #include "filenamematcher.h"
 
 namespace
 {
-/* Compare paths directory by directory. Last path component of each must be
- * a file. Files are sorted after directories within the same directory
- */
-bool compare_paths(
-	const std::string& l,
-	const std::string& r
-)
+/// A row with no items, yet
+comparison_t make_row()
 {
-	const std::size_t nl = l.length();
-	const std::size_t nr = r.length();
-
-	// directories before files
-	std::size_t il = 0; // start of path component
-	std::size_t ir = 0;
-
-	while ( true )
-	{
-		std::size_t jl = il; // find end of path component
-		std::size_t jr = ir;
+	comparison_t c = comparison_t();
 
-		while ( jl < nl && l[jl] != '/' )
-		{
-			++jl;
-		}
+	c.res  = NOT_COMPARED;
+	c.size = -1;
 
-		while ( jr < nr && r[jr] != '/' )
-		{
-			++jr;
-		}
+	c.identity[0].mtime_ns = -1;
+	c.identity[1].mtime_ns = -1;
 
-		if ( jl == nl && jr == nr )
-		{
-
-			// at last path component for both
-			return l.compare(il, jl - il, r, ir, jr - ir) < 0;
-		}
-
-		if ( jl == nl )
-		{
-
-			// first points to a file and files come after directories
-			return false;
-		}
-
-		if ( jr == nr )
-		{
-
-			// second points to a file and files come after directories
-			return true;
-		}
-
-		// both at directories
-		const int res = l.compare(il, jl - il, r, ir, jr - ir);
-
-		if ( res != 0 )
-		{
-			return res < 0;
-		}
+	return c;
+}
 
-		// next path component
-		il = jl + 1;
-		ir = jr + 1;
+/** Get what a tree recorded about a file, so a rematch can tell if an
+ * earlier result still holds
+ */
+void take_identity(
+	const DirectoryContents& tree,
+	std::size_t              i,
+	pbl::fs::file_identity&  id
+)
+{
+	if ( !tree.fileidentity(i, id) )
+	{
+		id.mtime_ns = -1;
 	}
 }
 
+/** Pairs up the files of two trees
+ *
+ * Rows are added in the order of PathPool::less, so the list never needs to be
+ * sorted: each directory's subdirectories are visited first, by name, and
+ * then its files are added, by name. Matching a file to one with a different
+ * name keeps the row where the left file is.
+ */
 class Rematcher
 {
 public:
+	Rematcher(
+		PathPool& pool_,
+		bool      quick_
+	)
+		: pool(pool_), quick(quick_)
+	{
+	}
+
 	const std::vector< comparison_t >& rematch(
 		const FileNameMatcher&   matcher,
 		const DirectoryContents& l,
@@ -129,14 +106,15 @@ private:
 			rematch_section(matcher, j, d, prefix + d.name() + "/");
 		}
 
+		const PathPool::id_type d = pool.directory(prefix);
+
 		for ( std::size_t i = 0, n = r.filecount(); i < n; ++i )
 		{
-			comparison_t c = { { std::string(), std::string() }, { std::string(), std::string() }, NOT_COMPARED, false };
-			c.items[j] = prefix + r.filename(i);
+			comparison_t c = make_row();
+			c.dir[j]  = d;
+			c.name[j] = pool.name( r.filename(i) );
 			list.push_back(c);
 		}
-
-		std::sort( list.begin(), list.end() );
 	}
 
 	void rematch(
@@ -227,14 +205,15 @@ private:
 		 */
 		std::vector< comparison_t > matched_files;
 
-		const std::size_t nl = l.filecount();
+		const PathPool::id_type d  = pool.directory(prefix);
+		const std::size_t       nl = l.filecount();
 		const std::size_t nr = r.filecount();
 		std::size_t       il = 0;
 		std::size_t       ir = 0;
 
 		for (; il < nl && ir < nr;)
 		{
-			comparison_t       c     = { { std::string(), std::string() }, { std::string(), std::string() }, NOT_COMPARED, false };
+			comparison_t       c     = make_row();
 			const std::string& lname = l.filename(il);
 			const std::string& rname = r.filename(ir);
 
@@ -244,12 +223,39 @@ private:
 
 				if ( res.weight != -1 )
 				{
-					c.command[0] = res.lcommand;
-					c.command[1] = res.rcommand;
+					c.command[0] = pool.name(res.lcommand);
+					c.command[1] = pool.name(res.rcommand);
+				}
+
+				c.dir[0]  = d;
+				c.dir[1]  = d;
+				c.name[0] = pool.name(lname);
+				c.name[1] = c.name[0];
+
+				/* Files of different sizes can't be the same, so there is no
+				 * need to open them. Unless a command converts them first
+				 */
+				const long long lsize = l.filesize(il);
+				const long long rsize = r.filesize(ir);
+
+				c.size = lsize;
+				take_identity(l, il, c.identity[0]);
+				take_identity(r, ir, c.identity[1]);
+
+				if ( lsize != -1 && rsize != -1 && c.command[0] == 0 && c.command[1] == 0 )
+				{
+					if ( lsize != rsize )
+					{
+						c.res = COMPARED_DIFFERENT;
+					}
+					else if ( quick && c.identity[0].mtime_ns != -1 && c.identity[1].mtime_ns != -1
+					          && c.identity[0].mtime_ns == c.identity[1].mtime_ns )
+					{
+						// Still compared later, but after everything else
+						c.res = PROBABLY_SAME;
+					}
 				}
 
-				c.items[0] = prefix + lname;
-				c.items[1] = prefix + rname;
 				++il;
 				++ir;
 			}
@@ -257,12 +263,17 @@ private:
 			{
 				if ( lname < rname )
 				{
-					c.items[0] = prefix + lname;
+					c.dir[0]  = d;
+					c.name[0] = pool.name(lname);
+					c.size    = l.filesize(il);
+					take_identity(l, il, c.identity[0]);
 					++il;
 				}
 				else
 				{
-					c.items[1] = prefix + rname;
+					c.dir[1]  = d;
+					c.name[1] = pool.name(rname);
+					take_identity(r, ir, c.identity[1]);
 					++ir;
 				}
 			}
@@ -272,83 +283,241 @@ private:
 
 		for (; il < nl; ++il )
 		{
-			comparison_t c = { { prefix + l.filename(il), std::string() }, { std::string(), std::string() }, NOT_COMPARED, false };
+			comparison_t c = make_row();
+			c.dir[0]  = d;
+			c.name[0] = pool.name( l.filename(il) );
+			c.size    = l.filesize(il);
+			take_identity(l, il, c.identity[0]);
 			matched_files.push_back(c);
 		}
 
 		for (; ir < nr; ++ir )
 		{
-			comparison_t c = { { std::string(), prefix + r.filename(ir) }, { std::string(), std::string() }, NOT_COMPARED, false };
+			comparison_t c = make_row();
+			c.dir[1]  = d;
+			c.name[1] = pool.name( r.filename(ir) );
+			take_identity(r, ir, c.identity[1]);
 			matched_files.push_back(c);
 		}
 
-		/* Second pass to match non-exact names. Items on the left that do not
-		 * have a match are checked against unmatched items on the right. If a
-		 * conversion is possible, they are matched and the right item is
-		 * removed.
+		/* Second pass to match non-exact names. Each unmatched name is
+		 * rewritten once by the rules, and the results are looked up among
+		 * the unmatched names on the other side. Then each unmatched left item,
+		 * in order, takes its best candidate that is still unmatched, and the
+		 * right item is removed.
 		 */
+		std::vector< std::string > paths( matched_files.size() );
+		std::vector< named_row >   lefts;
+		std::vector< named_row >   rights;
+
 		for ( std::size_t i = 0, n = matched_files.size(); i < n; ++i )
 		{
-			// Unmatched left item
-			if ( matched_files[i].items[1].empty() )
+			for ( std::size_t j = 0; j < 2; ++j )
+			{
+				if ( matched_files[i].has_only(j) )
+				{
+					// Rules apply to the whole relative path
+					paths[i] = prefix + pool.str(matched_files[i].name[j]);
+
+					const named_row t = { &paths[i], i };
+					( j == 0 ? lefts : rights ).push_back(t);
+				}
+			}
+		}
+
+		if ( lefts.empty() || rights.empty() )
+		{
+			list.insert( list.end(), matched_files.begin(), matched_files.end() );
+
+			return;
+		}
+
+		// Both are sorted, because matched_files is
+		std::vector< std::vector< candidate > > candidates( lefts.size() );
+
+		for ( std::size_t k = 0; k < lefts.size(); ++k )
+		{
+			const std::vector< FileNameMatcher::rewrite > v = matcher.rewrites(*lefts[k].name);
+
+			for ( std::size_t x = 0; x < v.size(); ++x )
 			{
-				// Find the best match
-				std::size_t ibest = 0;
-				int         xbest = -1;
-				std::string lcommand;
-				std::string rcommand;
+				const std::size_t j = find(rights, v[x].name);
 
-				for ( std::size_t j = 0; j < n; ++j )
+				if ( j != rights.size() )
 				{
-					if ( matched_files[j].items[0].empty() )
-					{
-						const FileNameMatcher::match_result res = matcher(matched_files[i].items[0], matched_files[j].items[1]);
-
-						if ( res.weight >= 0 )
-						{
-							if ( xbest == -1 || res.weight < xbest )
-							{
-								ibest    = j;
-								xbest    = res.weight;
-								lcommand = res.lcommand;
-								rcommand = res.rcommand;
-							}
-						}
-					}
+					add_candidate(candidates[k], rights[j].row, v[x].result, false);
 				}
+			}
+		}
 
-				// If there is one, delete it and fixup i, n
-				if ( xbest != -1 )
+		for ( std::size_t j = 0; j < rights.size(); ++j )
+		{
+			const std::vector< FileNameMatcher::rewrite > v = matcher.rewrites(*rights[j].name);
+
+			for ( std::size_t x = 0; x < v.size(); ++x )
+			{
+				const std::size_t k = find(lefts, v[x].name);
+
+				if ( k != lefts.size() )
 				{
-					matched_files[i].items[1]   = matched_files[ibest].items[1];
-					matched_files[i].command[0] = lcommand;
-					matched_files[i].command[1] = rcommand;
-					matched_files.erase(matched_files.begin() + ibest);
-					--n;
+					add_candidate(candidates[k], rights[j].row, v[x].result, true);
+				}
+			}
+		}
 
-					if ( ibest < i )
-					{
-						--i;
-					}
+		std::vector< bool > taken(matched_files.size(), false);
+
+		for ( std::size_t k = 0; k < lefts.size(); ++k )
+		{
+			// Lowest weight wins, then the first right item
+			const candidate* best = 0;
+
+			for ( std::size_t x = 0; x < candidates[k].size(); ++x )
+			{
+				const candidate& c = candidates[k][x];
+				const int        w = c.combined().weight;
+
+				if ( w >= 0 && !taken[c.right]
+				     && ( !best || w < best->combined().weight || ( w == best->combined().weight && c.right < best->right ) ) )
+				{
+					best = &c;
 				}
 			}
+
+			if ( best )
+			{
+				const FileNameMatcher::match_result& res = best->combined();
+				comparison_t&                        row = matched_files[lefts[k].row];
+
+				row.dir[1]         = matched_files[best->right].dir[1];
+				row.name[1]        = matched_files[best->right].name[1];
+				row.identity[1]    = matched_files[best->right].identity[1];
+				row.command[0]     = pool.name(res.lcommand);
+				row.command[1]     = pool.name(res.rcommand);
+				taken[best->right] = true;
+			}
 		}
 
-		list.insert( list.end(), matched_files.begin(), matched_files.end() );
-		std::sort( list.begin(), list.end() );
+		for ( std::size_t i = 0, n = matched_files.size(); i < n; ++i )
+		{
+			if ( !taken[i] )
+			{
+				list.push_back(matched_files[i]);
+			}
+		}
 	}
 
+	/** An item in a directory that has no match yet
+	 */
+	struct named_row
+	{
+		const std::string* name;
+		std::size_t        row;
+	};
+
+	/** A right item that an unmatched left item could be matched to
+	 */
+	struct candidate
+	{
+		std::size_t right;
+
+		/// Best rule that turns the left name into the right, and the reverse
+		FileNameMatcher::match_result forward;
+		FileNameMatcher::match_result reverse;
+
+		/// Choose between directions like FileNameMatcher::operator() does
+		const FileNameMatcher::match_result& combined() const
+		{
+			if ( forward.weight == -1 )
+			{
+				return reverse;
+			}
+
+			if ( reverse.weight == -1 )
+			{
+				return forward;
+			}
+
+			return ( forward.weight < reverse.weight ) ? forward : reverse;
+		}
+	};
+
+	/** Find a name among sorted rows
+	 * @returns The index, or v.size() if it is not there
+	 */
+	static std::size_t find(
+		const std::vector< named_row >& v,
+		const std::string&              name
+	)
+	{
+		std::size_t lo = 0;
+		std::size_t hi = v.size();
+
+		while ( lo < hi )
+		{
+			const std::size_t mid = lo + ( hi - lo ) / 2;
+
+			if ( *v[mid].name < name )
+			{
+				lo = mid + 1;
+			}
+			else
+			{
+				hi = mid;
+			}
+		}
+
+		return ( lo < v.size() && *v[lo].name == name ) ? lo : v.size();
+	}
+
+	/** Note that a rule matches a left item to a right item, keeping the
+	 * first rule with the lowest weight in each direction
+	 */
+	static void add_candidate(
+		std::vector< candidate >&            v,
+		std::size_t                          right,
+		const FileNameMatcher::match_result& res,
+		bool                                 reverse
+	)
+	{
+		std::size_t i = 0;
+
+		while ( i < v.size() && v[i].right != right )
+		{
+			++i;
+		}
+
+		if ( i == v.size() )
+		{
+			const candidate c = { right, { -1, std::string(), std::string() }, { -1, std::string(), std::string() } };
+			v.push_back(c);
+		}
+
+		FileNameMatcher::match_result& best = reverse ? v[i].reverse : v[i].forward;
+
+		if ( best.weight == -1 || res.weight < best.weight )
+		{
+			best = res;
+		}
+	}
+
+	/// Where the names of the rows are stored
+	PathPool& pool;
+
 	std::vector< comparison_t > list;
+
+	/// Guess the result from the metadata of the files
+	bool quick;
 };
 }
 
 bool comparison_t::has_only(std::size_t i) const
 {
-	if ( !items[i].empty() )
+	if ( name[i] != 0 )
 	{
 		for ( std::size_t j = 0; j < 2; ++j )
 		{
-			if ( j != i && !items[j].empty() )
+			if ( j != i && name[j] != 0 )
 			{
 				return false;
 			}
@@ -362,21 +531,57 @@ bool comparison_t::has_only(std::size_t i) const
 
 bool comparison_t::unmatched() const
 {
-	return items[0].empty() || items[1].empty();
+	return name[0] == 0 || name[1] == 0;
 }
 
-bool comparison_t::operator<(const comparison_t& b) const
+std::string comparison_t::item(
+	const PathPool& pool,
+	std::size_t     i
+) const
 {
-	return compare_paths(items[0].empty() ? items[1] : items[0], b.items[0].empty() ? b.items[1] : b.items[0]);
+	return pool.path(dir[i], name[i]);
+}
+
+bool comparison_t::less(
+	const PathPool&     pool,
+	const comparison_t& b
+) const
+{
+	const std::size_t i = name[0] == 0 ? 1 : 0;
+	const std::size_t j = b.name[0] == 0 ? 1 : 0;
+
+	return pool.less(dir[i], name[i], b.dir[j], b.name[j]);
 }
 
 std::vector< comparison_t > match_directories(
+	PathPool&                pool,
 	const FileNameMatcher&   matcher,
 	const DirectoryContents& l,
-	const DirectoryContents& r
+	const DirectoryContents& r,
+	bool                     quick
 )
 {
-	Rematcher t;
+	Rematcher t(pool, quick);
 
 	return t.rematch(matcher, l, r);
 }
+
+void compact_names(
+	PathPool&                    pool,
+	std::vector< comparison_t >& rows
+)
+{
+	PathPool kept;
+
+	for ( std::size_t i = 0, n = rows.size(); i < n; ++i )
+	{
+		for ( std::size_t k = 0; k < 2; ++k )
+		{
+			rows[i].dir[k]     = kept.directory( pool.prefix(rows[i].dir[k]) );
+			rows[i].name[k]    = kept.name( pool.str(rows[i].name[k]) );
+			rows[i].command[k] = kept.name( pool.str(rows[i].command[k]) );
+		}
+	}
+
+	pool.swap(kept);
+}
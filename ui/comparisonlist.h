@@ -32,25 +32,61 @@
 #include <string>
 #include <vector>
 
+#include "pbl/fileutil/hashcache.h"
+#include "pathpool.h"
+
 class FileNameMatcher;
 class DirectoryContents;
 
-enum compare_result_t {NOT_COMPARED, COMPARED_SAME, COMPARED_DIFFERENT};
+/// PROBABLY_SAME is a guess from size and time, until the contents are compared
+enum compare_result_t {NOT_COMPARED, COMPARED_SAME, COMPARED_DIFFERENT, PROBABLY_SAME};
 
+/** A row of the comparison list
+ *
+ * Names are ids in a PathPool, which all rows of a list share
+ */
 struct comparison_t
 {
-	std::string items[2];   // { left, right }
-	std::string command[2]; // command to run on left and right items when comparing
+	PathPool::id_type dir[2];     // { left, right } directory of each item
+	PathPool::id_type name[2];    // { left, right } or 0 if there is no item
+	PathPool::id_type command[2]; // command to run on left and right items when comparing
 	compare_result_t res;
 	bool ignore;
 
+	/// Paired after matching, because the items have the same contents
+	bool moved;
+
+	unsigned long long job; // id of the queued comparison, or 0 if none
+	long long size;         // of the left item, or -1 if not known yet
+
+	/// The items, as they were last scanned or compared. mtime_ns is -1 if not known
+	pbl::fs::file_identity identity[2];
+
 	bool has_only(std::size_t i) const;
 
 	bool unmatched() const;
 
-	bool operator<(const comparison_t&) const;
+	/** Get the path of the left (0) or right (1) item, or an empty string
+	 */
+	std::string item(const PathPool&, std::size_t i) const;
+
+	/** Order rows by their left item, or right item if there is no left
+	 */
+	bool less(const PathPool&, const comparison_t&) const;
 };
 
-std::vector< comparison_t > match_directories(const FileNameMatcher&, const DirectoryContents&, const DirectoryContents&);
+/** Pair up the files of two trees
+ * @param pool Where the names of the rows are stored
+ * @param quick Guess that files with the same size and modification time are
+ *   the same, if the trees recorded them
+ */
+std::vector< comparison_t > match_directories(PathPool& pool, const FileNameMatcher&, const DirectoryContents&, const DirectoryContents&, bool quick);
+
+/** Drop the names that no row uses anymore, ex., of rows that were removed
+ *
+ * The names of the rows are moved to a new pool, and their ids changed to
+ * match.
+ */
+void compact_names(PathPool& pool, std::vector< comparison_t >& rows);
 
 #endif // COMPARISONLIST_H
@@ -32,6 +32,7 @@
 #include "dirdiffform.h"
 #include "ui_dirdiffform.h"
 
+#include <algorithm>
 #include <iostream>
 #include <set>
 
@@ -44,10 +45,13 @@
 #include <QFileSystemWatcher>
 #include <QDesktopServices>
 #include <QUrl>
+#include <QDir>
+#include <QStandardPaths>
 
 #include "cpp/filesystem.h"
 
 #include "pbl/fileutil/compare.h"
+#include "pbl/fileutil/contenthash.h"
 #include "pbl/fileutil/reduce_paths.h"
 #include "pbl/util/strings.h"
 #include "pbl/process/which.h"
@@ -63,19 +67,20 @@
 DirDiffForm::DirDiffForm(QWidget* parent_)
 	: QWidget(parent_),
 	ui(new Ui::DirDiffForm),
+	compare_queue(0),
+	reader(0),
+	next_job(1),
+	onscreen_first(0), onscreen_last(-1),
 	hide_section_only(),
 	hide_identical_items(false), hide_ignored(false),
+	unvalidated(false), validator(0), detector(0),
+	names_used(0),
 	watcher()
 {
 	ui->setupUi(this);
 	populate_filters();
 
-	FileCompare* comparer = new FileCompare;
-	comparer->moveToThread(&compare_thread);
-	connect(&compare_thread, &QThread::finished, comparer, &QObject::deleteLater);
-	connect(this, &DirDiffForm::compare_files, comparer, &FileCompare::compare);
-	connect(comparer, &FileCompare::compared, this, &DirDiffForm::items_compared);
-	compare_thread.start();
+	start_workers();
 
 	ui->copytoleft->setIcon( get_icon("edit-copy") );
 	ui->copytoright->setIcon( get_icon("edit-copy") );
@@ -95,6 +100,8 @@ DirDiffForm::DirDiffForm(QWidget* parent_)
 	ui->multilistview->addAction(ui->actionSelect_Left_Only);
 	ui->multilistview->addAction(ui->actionSelect_Right_Only);
 	connect(ui->multilistview, &MultiList::itemActivated, this, &DirDiffForm::viewfiles);
+	connect(ui->multilistview, &MultiList::viewportChanged, this, &DirDiffForm::viewport_changed);
+	connect(ui->multilistview, &MultiList::selectionChanged, this, &DirDiffForm::selection_changed);
 
 	watcher = new QFileSystemWatcher(this);
 	connect(watcher, &QFileSystemWatcher::directoryChanged, this, &DirDiffForm::contentsChanged);
@@ -102,11 +109,107 @@ DirDiffForm::DirDiffForm(QWidget* parent_)
 
 DirDiffForm::~DirDiffForm()
 {
-	compare_thread.quit();
-	compare_thread.wait();
+	// Includes validators that were cancelled, but are still finishing
+	const QList< TreeValidator* > validators = findChildren< TreeValidator* >();
+
+	for ( int i = 0; i < validators.size(); ++i )
+	{
+		validators[i]->cancel();
+		validators[i]->wait();
+	}
+
+	const QList< MoveDetector* > detectors = findChildren< MoveDetector* >();
+
+	for ( int i = 0; i < detectors.size(); ++i )
+	{
+		detectors[i]->cancel();
+		detectors[i]->wait();
+	}
+
+	stop_workers();
 	delete ui;
 }
 
+void DirDiffForm::start_workers()
+{
+	const MySettings& settings = MySettings::instance();
+
+	int nthreads = settings.getCompareThreads();
+
+	if ( nthreads <= 0 )
+	{
+		nthreads = std::max(QThread::idealThreadCount(), 1);
+	}
+
+	compare_queue.setCapacity( static_cast< std::size_t >( nthreads ) * static_cast< std::size_t >( std::max(settings.getCompareQueueDepth(), 1) ) );
+	compare_queue.reopen();
+
+	const bool use_cache = settings.getHashCache();
+
+	if ( !use_cache )
+	{
+		hash_cache.close();
+	}
+	else if ( !hash_cache.is_open() )
+	{
+		const QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+
+		if ( !dir.isEmpty() && QDir().mkpath(dir) )
+		{
+			// If this fails, hashes are still remembered until the program exits
+			hash_cache.open( qt::convert( dir + "/hashes" ) );
+		}
+	}
+
+	if ( settings.getAsyncRead() )
+	{
+		// Enough for each worker to have a few blocks of both files in flight
+		reader = pbl::fs::AsyncReader::create(static_cast< unsigned >( nthreads ) * 8);
+	}
+
+	qRegisterMetaType< pbl::fs::file_identity >();
+
+	for ( int i = 0; i < nthreads; ++i )
+	{
+		QThread*     thread   = new QThread(this);
+		FileCompare* comparer = new FileCompare(&compare_queue, use_cache ? &hash_cache : 0, reader);
+		comparer->moveToThread(thread);
+		connect(thread, &QThread::started, comparer, &FileCompare::run);
+		connect(thread, &QThread::finished, comparer, &QObject::deleteLater);
+		connect(comparer, &FileCompare::compared, this, &DirDiffForm::items_compared);
+		thread->start();
+		compare_threads.push_back(thread);
+	}
+}
+
+void DirDiffForm::stop_workers()
+{
+	// Workers return from FileCompare::run once the queue is closed
+	compare_queue.close();
+
+	for ( std::size_t i = 0; i < compare_threads.size(); ++i )
+	{
+		compare_threads[i]->quit();
+		compare_threads[i]->wait();
+		delete compare_threads[i];
+	}
+
+	compare_threads.clear();
+
+	// No worker is using the reader anymore
+	delete reader;
+	reader = 0;
+
+	// Anything that was queued has been discarded
+	for ( std::map< unsigned long long, std::size_t >::const_iterator it = job_rows.begin(); it != job_rows.end(); ++it )
+	{
+		list[it->second].job = 0;
+		schedule_row(it->second);
+	}
+
+	job_rows.clear();
+}
+
 void DirDiffForm::setFlags(
 	bool show_left_only,
 	bool show_right_only,
@@ -121,6 +224,16 @@ void DirDiffForm::setFlags(
 void DirDiffForm::settingsChanged()
 {
 	populate_filters();
+
+	// Thread count or queue depth may have changed
+	stop_workers();
+	start_workers();
+
+	// Directories that were read with other settings are read again. Others are kept
+	apply_scan_settings();
+	change_depth();
+
+	startComparison();
 }
 
 void DirDiffForm::on_viewdiff_clicked()
@@ -132,8 +245,8 @@ void DirDiffForm::viewfiles(int r)
 {
 	if ( r >= 0 )
 	{
-		const std::string s1 = list[r].items[0];
-		const std::string s2 = list[r].items[1];
+		const std::string s1 = list[r].item(names, 0);
+		const std::string s2 = list[r].item(names, 1);
 
 		if ( s1.empty() && s2.empty() )
 		{
@@ -184,7 +297,7 @@ void DirDiffForm::viewfiles(int r)
 		{
 			const std::size_t i = ( s1.empty() ? 1 : 0 );
 
-			cpp::filesystem::path p(section_tree[i].name() + "/" + list[r].items[i]);
+			cpp::filesystem::path p(section_tree[i].name() + "/" + list[r].item(names, i));
 			cpp::filesystem::path q = p.parent_path();
 
 			QString program = settings.getEditor();
@@ -313,9 +426,9 @@ std::vector< std::string > DirDiffForm::get_section_files(std::size_t j)
 
 	for ( int i = 0, n = indices.count(); i < n; ++i )
 	{
-		if ( !list[indices[i]].items[j].empty() )
+		if ( list[indices[i]].name[j] != 0 )
 		{
-			rels.push_back(list[indices[i]].items[j]);
+			rels.push_back( list[indices[i]].item(names, j) );
 		}
 	}
 
@@ -389,9 +502,10 @@ void DirDiffForm::change_depth()
 {
 	const int d = get_depth();
 
-	section_tree[0].change_depth(d);
-	section_tree[1].change_depth(d);
-	file_list_changed(d, false);
+	cancel_validation();
+	DirectoryContents::change_depth(section_tree[0], section_tree[1], d);
+	file_list_changed(d, false, false);
+	start_validation(d);
 }
 
 void DirDiffForm::open_section(std::size_t i)
@@ -405,19 +519,314 @@ void DirDiffForm::open_section(std::size_t i)
 	}
 }
 
+void DirDiffForm::apply_scan_settings()
+{
+	const MySettings& settings = MySettings::instance();
+
+	pbl::fs::IgnoreRules rules;
+	const QStringList    patterns = settings.getIgnoreRules();
+
+	for ( int i = 0; i < patterns.count(); ++i )
+	{
+		rules.add( qt::convert( patterns.at(i) ) );
+	}
+
+	for ( std::size_t i = 0; i < 2; ++i )
+	{
+		// Quick compare needs the size and time of each file
+		section_tree[i].record_metadata( settings.getScanMetadata() || settings.getQuickCompare() );
+		section_tree[i].ignore( rules, settings.getGitIgnore() );
+	}
+}
+
 // depth has not changed, but one or both directories have changed
 void DirDiffForm::change_dir(
 	const std::string& left,
 	const std::string& right
 )
 {
-	const int  d        = get_depth();
-	const bool lchanged = section_tree[0].change_root(left, d);
-	const bool rchanged = section_tree[1].change_root(right, d);
+	const int d = get_depth();
+
+	const MySettings& settings = MySettings::instance();
+
+	apply_scan_settings();
+
+	const bool lchanged = section_tree[0].set_root(left);
+	const bool rchanged = section_tree[1].set_root(right);
 
 	if ( lchanged || rchanged )
 	{
-		file_list_changed(d, true);
+		cancel_validation();
+
+		if ( settings.getSnapshots() )
+		{
+			const bool changed[2] = { lchanged, rchanged };
+
+			for ( std::size_t i = 0; i < 2; ++i )
+			{
+				if ( changed[i] && section_tree[i].valid() && section_tree[i].load( snapshot_path(section_tree[i]) ) )
+				{
+					unvalidated = true;
+				}
+			}
+		}
+
+		// Scan both sides at once. Directories from a snapshot are not read
+		DirectoryContents::change_depth(section_tree[0], section_tree[1], d);
+		file_list_changed(d, true, false);
+
+		if ( unvalidated )
+		{
+			start_validation(d);
+		}
+		else
+		{
+			save_snapshots();
+		}
+	}
+}
+
+std::string DirDiffForm::snapshot_path(const DirectoryContents& tree) const
+{
+	const QString cache = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+
+	if ( !tree.valid() || cache.isEmpty() || !QDir().mkpath(cache + "/trees") )
+	{
+		return std::string();
+	}
+
+	const std::string root = tree.name();
+
+	pbl::fs::content_hasher h;
+
+	h.update( root.data(), root.length() );
+
+	const pbl::fs::content_hash x = h.digest();
+
+	return qt::convert( cache + QString("/trees/%1%2").arg(x.h1, 16, 16, QChar('0') ).arg(x.h2, 16, 16, QChar('0') ) );
+}
+
+void DirDiffForm::save_snapshots()
+{
+	if ( MySettings::instance().getSnapshots() )
+	{
+		for ( std::size_t i = 0; i < 2; ++i )
+		{
+			const std::string path = snapshot_path(section_tree[i]);
+
+			if ( !path.empty() )
+			{
+				section_tree[i].save(path);
+			}
+		}
+	}
+}
+
+void DirDiffForm::cancel_validation()
+{
+	if ( validator )
+	{
+		// It deletes itself when it finishes
+		validator->cancel();
+		validator = 0;
+	}
+}
+
+void DirDiffForm::start_validation(int d)
+{
+	if ( unvalidated )
+	{
+		changed_while_validating.clear();
+		validator = new TreeValidator(section_tree[0], section_tree[1], d, snapshot_path(section_tree[0]), snapshot_path(section_tree[1]), this);
+		connect(validator, &QThread::finished, this, &DirDiffForm::trees_validated);
+		validator->start();
+	}
+}
+
+void DirDiffForm::trees_validated()
+{
+	TreeValidator* v = qobject_cast< TreeValidator* >( sender() );
+
+	if ( v && v == validator )
+	{
+		validator   = 0;
+		unvalidated = false;
+		v->take(section_tree[0], section_tree[1]);
+
+		// The validator may have read these before they changed
+		for ( std::size_t i = 0; i < changed_while_validating.size(); ++i )
+		{
+			section_tree[0].rescan(changed_while_validating[i], v->depth() );
+			section_tree[1].rescan(changed_while_validating[i], v->depth() );
+		}
+
+		changed_while_validating.clear();
+
+		/* Results so far came from the snapshots, ex., files of different
+		 * sizes. Validation stat-ed every file again, so keep only results
+		 * for files whose identity still matches
+		 */
+		file_list_changed(v->depth(), false, true);
+	}
+
+	if ( v )
+	{
+		v->deleteLater();
+	}
+}
+
+void DirDiffForm::cancel_move_detection()
+{
+	if ( detector )
+	{
+		// It deletes itself when it finishes
+		detector->cancel();
+		detector = 0;
+	}
+}
+
+void DirDiffForm::start_move_detection()
+{
+	const MySettings& settings = MySettings::instance();
+
+	if ( !settings.getDetectMoves() || !section_tree[0].valid() || !section_tree[1].valid() )
+	{
+		return;
+	}
+
+	std::vector< std::string > only[2];
+
+	for ( std::size_t i = 0, n = list.size(); i < n; ++i )
+	{
+		for ( std::size_t j = 0; j < 2; ++j )
+		{
+			if ( list[i].has_only(j) )
+			{
+				only[j].push_back( list[i].item(names, j) );
+			}
+		}
+	}
+
+	if ( !only[0].empty() && !only[1].empty() )
+	{
+		const long long limit = settings.getFileSizeCompareLimit();
+
+		detector = new MoveDetector(section_tree[0].name(), section_tree[1].name(), only[0], only[1], limit * 1024 * 1024, hash_cache.is_open() ? &hash_cache : 0, this);
+		connect(detector, &QThread::finished, this, &DirDiffForm::moves_detected);
+		detector->start();
+	}
+}
+
+void DirDiffForm::moves_detected()
+{
+	MoveDetector* d = qobject_cast< MoveDetector* >( sender() );
+
+	if ( d && d == detector )
+	{
+		detector = 0;
+
+		const std::vector< MoveDetector::move >& moves = d->moves();
+
+		if ( !moves.empty() )
+		{
+			// Rows that are still only on one side, by path
+			std::map< std::string, std::size_t > only[2];
+
+			for ( std::size_t i = 0, n = list.size(); i < n; ++i )
+			{
+				for ( std::size_t j = 0; j < 2; ++j )
+				{
+					if ( list[i].has_only(j) )
+					{
+						only[j][list[i].item(names, j)] = i;
+					}
+				}
+			}
+
+			/* Right only rows that are now paired with a left only row. Each
+			 * one is folded into the row it was paired with
+			 */
+			const std::size_t          n = list.size();
+			std::vector< std::size_t > paired(n, n);
+
+			for ( std::size_t k = 0; k < moves.size(); ++k )
+			{
+				const std::map< std::string, std::size_t >::iterator l = only[0].find(moves[k].left);
+				const std::map< std::string, std::size_t >::iterator r = only[1].find(moves[k].right);
+
+				if ( l != only[0].end() && r != only[1].end() )
+				{
+					const std::size_t i = l->second;
+					const std::size_t j = r->second;
+
+					list[i].dir[1]      = list[j].dir[1];
+					list[i].name[1]     = list[j].name[1];
+					list[i].res         = COMPARED_SAME;
+					list[i].moved       = true;
+					list[i].identity[0] = moves[k].identity[0];
+					list[i].identity[1] = moves[k].identity[1];
+					paired[j]           = i;
+				}
+			}
+
+			// Remove the folded rows in one pass, noting where the others end up
+			std::vector< std::size_t > new_row(n);
+			std::size_t                m = 0;
+
+			for ( std::size_t i = 0; i < n; ++i )
+			{
+				if ( paired[i] == n )
+				{
+					if ( m != i )
+					{
+						list[m] = list[i];
+					}
+
+					new_row[i] = m++;
+				}
+			}
+
+			list.resize(m);
+
+			// Rebuild the view once, keeping the selection on the same items
+			const QList< int > old_selection = ui->multilistview->selectedRows();
+			QList< int >       selection;
+
+			for ( int k = 0; k < old_selection.count(); ++k )
+			{
+				const std::size_t i = static_cast< std::size_t >( old_selection.at(k) );
+
+				if ( i < n )
+				{
+					const int r = static_cast< int >( new_row[paired[i] == n ? i : paired[i]] );
+
+					if ( !selection.contains(r) )
+					{
+						selection.append(r);
+					}
+				}
+			}
+
+			ui->multilistview->clear();
+
+			for ( std::size_t i = 0; i < m; ++i )
+			{
+				QStringList items;
+				items << qt::convert( list[i].item(names, 0) ) << qt::convert( list[i].item(names, 1) );
+				ui->multilistview->addItem(items);
+			}
+
+			ui->multilistview->setSelectedRows(selection);
+
+			map_job_rows();
+			applyFilters();
+			reschedule();
+		}
+	}
+
+	if ( d )
+	{
+		d->deleteLater();
 	}
 }
 
@@ -461,11 +870,15 @@ QStringList DirDiffForm::find_subdirs(
 
 void DirDiffForm::file_list_changed(
 	int  depth,
-	bool rootchanged
+	bool rootchanged,
+	bool recheck
 )
 {
 	stopDirectoryWatcher();
 
+	// Its rows are about to change
+	cancel_move_detection();
+
 	// Update the text of the open directory buttons
 	if ( !section_tree[0].valid() )
 	{
@@ -498,7 +911,13 @@ void DirDiffForm::file_list_changed(
 
 	// Rematch files
 	FileNameMatcher             name_matcher( settings.getMatchRules() );
-	std::vector< comparison_t > matched = match_directories(name_matcher, section_tree[0], section_tree[1]);
+	if ( rootchanged )
+	{
+		// No rows will be kept, so neither are their names
+		names.clear();
+	}
+
+	std::vector< comparison_t > matched = match_directories( names, name_matcher, section_tree[0], section_tree[1], settings.getQuickCompare() );
 
 	if ( !rootchanged )
 	{
@@ -509,17 +928,17 @@ void DirDiffForm::file_list_changed(
 		// Both lists are in sorted order
 		while ( i < n && j < m )
 		{
-			if ( list[i] < matched[j] )
+			if ( list[i].less(names, matched[j]) )
 			{
 				list.erase(list.begin() + i);
 				--n;
 				ui->multilistview->removeItem(i);
 			}
-			else if ( matched[j] < list[i] )
+			else if ( matched[j].less(names, list[i]) )
 			{
 				list.insert(list.begin() + i, matched[j]);
 				QStringList labels;
-				labels << qt::convert(matched[j].items[0]) << qt::convert(matched[j].items[1]);
+				labels << qt::convert( matched[j].item(names, 0) ) << qt::convert( matched[j].item(names, 1) );
 				ui->multilistview->insertItem(i, labels);
 				++n;
 				++j;
@@ -527,6 +946,35 @@ void DirDiffForm::file_list_changed(
 			}
 			else
 			{
+				// Moves are found again, after matching
+				if ( list[i].moved )
+				{
+					list[i] = matched[j];
+					ui->multilistview->setText( 1, i, qt::convert( list[i].item(names, 1) ) );
+				}
+
+				// Drop results for files that the scan shows have changed since
+				const bool known = matched[j].identity[0].mtime_ns != -1 && matched[j].identity[1].mtime_ns != -1;
+
+				if ( list[i].res != NOT_COMPARED && list[i].job == 0 && ( known || recheck ) && !unchanged(i, matched[j]) )
+				{
+					list[i].res = NOT_COMPARED;
+				}
+
+				// Take results that scanning could tell, ex., from file sizes
+				if ( list[i].res == NOT_COMPARED && list[i].job == 0 && matched[j].res != NOT_COMPARED )
+				{
+					list[i].res         = matched[j].res;
+					list[i].size        = matched[j].size;
+					list[i].identity[0] = matched[j].identity[0];
+					list[i].identity[1] = matched[j].identity[1];
+				}
+
+				if ( list[i].size < 0 )
+				{
+					list[i].size = matched[j].size;
+				}
+
 				++i, ++j;
 			}
 		}
@@ -542,26 +990,40 @@ void DirDiffForm::file_list_changed(
 		{
 			list.insert(list.end(), matched[j]);
 			QStringList labels;
-			labels << qt::convert(matched[j].items[0]) << qt::convert(matched[j].items[1]);
+			labels << qt::convert( matched[j].item(names, 0) ) << qt::convert( matched[j].item(names, 1) );
 			ui->multilistview->insertItem(i, labels);
 			++j;
 			++i;
 		}
+
+		// Names of removed rows stay in the pool until it has doubled
+		if ( names.size() > 2 * names_used )
+		{
+			compact_names(names, list);
+			names_used = names.size();
+		}
 	}
 	else
 	{
+		// Comparisons of the old directories are no longer needed
+		compare_queue.cancel();
+		job_rows.clear();
+
 		ui->multilistview->clear();
 		list.swap(matched);
+		names_used = names.size();
 
 		for ( std::size_t i = 0; i < list.size(); ++i )
 		{
 			QStringList items;
-			items << qt::convert(list[i].items[0]) << qt::convert(list[i].items[1]);
+			items << qt::convert( list[i].item(names, 0) ) << qt::convert( list[i].item(names, 1) );
 			ui->multilistview->addItem(items);
 		}
 	}
 
+	map_job_rows();
 	applyFilters();
+	reschedule();
 
 	// Update file system watcher
 	watched_dirs.clear();
@@ -575,6 +1037,7 @@ void DirDiffForm::file_list_changed(
 	}
 
 	startComparison();
+	start_move_detection();
 }
 
 void DirDiffForm::changeDirectories(
@@ -646,15 +1109,20 @@ void DirDiffForm::contentsChanged(QString dirname_)
 	section_tree[0].rescan(dirname, d);
 	section_tree[1].rescan(dirname, d);
 
-	file_list_changed(d, false);
+	if ( validator )
+	{
+		changed_while_validating.push_back(dirname);
+	}
+
+	file_list_changed(d, false, false);
 }
 
 void DirDiffForm::filesChanged(const std::set< std::string >& files)
 {
 	for ( std::size_t i = 0; i < list.size(); ++i )
 	{
-		if ( ( section_tree[0].valid() && !list[i].items[0].empty() && files.count(section_tree[0].name() + "/" + list[i].items[0]) != 0 )
-		     || ( section_tree[1].valid() && !list[i].items[1].empty() && files.count(section_tree[1].name() + "/" + list[i].items[1]) != 0 ) )
+		if ( ( section_tree[0].valid() && list[i].name[0] != 0 && files.count(section_tree[0].name() + "/" + list[i].item(names, 0)) != 0 )
+		     || ( section_tree[1].valid() && list[i].name[1] != 0 && files.count(section_tree[1].name() + "/" + list[i].item(names, 1)) != 0 ) )
 		{
 			list[i].res = NOT_COMPARED;
 		}
@@ -670,15 +1138,34 @@ void DirDiffForm::on_refresh_clicked()
 
 void DirDiffForm::refresh()
 {
-	section_tree[0].change_depth(0);
-	section_tree[1].change_depth(0);
+	// Validating reads every directory whose metadata changed, so a separate validation is not needed
+	cancel_validation();
+	unvalidated = false;
 
-	for ( std::size_t i = 0, n = list.size(); i < n; ++i )
+	const int d = get_depth();
+
+	DirectoryContents::validate(section_tree[0], section_tree[1], d);
+
+	// Results are kept for files whose metadata shows they haven't changed
+	file_list_changed(d, false, true);
+}
+
+bool DirDiffForm::unchanged(
+	std::size_t         i,
+	const comparison_t& scanned
+) const
+{
+	for ( std::size_t k = 0; k < 2; ++k )
 	{
-		list[i].res = NOT_COMPARED;
+		if ( list[i].identity[k].mtime_ns == -1
+		     || scanned.identity[k].mtime_ns == -1
+		     || !( scanned.identity[k] == list[i].identity[k] ) )
+		{
+			return false;
+		}
 	}
 
-	change_depth();
+	return true;
 }
 
 int DirDiffForm::get_depth()
@@ -693,14 +1180,17 @@ int DirDiffForm::get_depth()
 
 void DirDiffForm::on_swap_clicked()
 {
+	cancel_validation();
 	section_tree[0].swap(section_tree[1]);
 
 	for ( std::size_t i = 0; i < list.size(); ++i )
 	{
-		std::swap(list[i].items[0], list[i].items[1]);
+		std::swap(list[i].dir[0], list[i].dir[1]);
+		std::swap(list[i].name[0], list[i].name[1]);
 	}
 
-	file_list_changed(get_depth(), true);
+	file_list_changed(get_depth(), true, false);
+	start_validation( get_depth() );
 }
 
 void DirDiffForm::explore_section(std::size_t i)
@@ -803,8 +1293,9 @@ bool DirDiffForm::hidden(std::size_t i) const
 		hideitem = true;
 	}
 
-	// Hide items that have compared identical
-	if ( hide_identical_items && list[i].res == COMPARED_SAME )
+	// Hide items that have compared identical, or probably will. Moves are
+	// still changes
+	if ( hide_identical_items && !list[i].moved && ( list[i].res == COMPARED_SAME || list[i].res == PROBABLY_SAME ) )
 	{
 		hideitem = true;
 	}
@@ -816,8 +1307,8 @@ bool DirDiffForm::hidden(std::size_t i) const
 
 		for ( int j = 0; j < filters.count(); ++j )
 		{
-			if ( filters.at(j).exactMatch( qt::convert(list[i].items[0]) )
-			     || filters.at(j).exactMatch( qt::convert(list[i].items[1]) ) )
+			if ( filters.at(j).exactMatch( qt::convert( list[i].item(names, 0) ) )
+			     || filters.at(j).exactMatch( qt::convert( list[i].item(names, 1) ) ) )
 			{
 				hideitem = false;
 				break;
@@ -835,6 +1326,9 @@ void DirDiffForm::applyFilters()
 
 	QList< int > new_selection;
 
+	// Rows that were shown and are now hidden, or the other way around
+	std::vector< std::size_t > toggled;
+
 	bool              seen_selected                   = false;
 	const std::size_t n                               = list.size();
 	std::size_t       first_unselected_after_selected = n;
@@ -845,8 +1339,13 @@ void DirDiffForm::applyFilters()
 	{
 		const bool hideitem = hidden(i);
 
-		ui->multilistview->style(i, list[i].ignore, list[i].unmatched(), list[i].res != NOT_COMPARED, list[i].res == COMPARED_SAME);
-		ui->multilistview->setRowHidden(i, hideitem);
+		ui->multilistview->style(i, list[i].ignore, list[i].unmatched(), list[i].res != NOT_COMPARED, list[i].res == COMPARED_SAME || list[i].res == PROBABLY_SAME, list[i].res == PROBABLY_SAME, list[i].moved);
+
+		if ( hideitem != ui->multilistview->isRowHidden(i) )
+		{
+			ui->multilistview->setRowHidden(i, hideitem);
+			toggled.push_back(i);
+		}
 
 		if ( sel.contains(i) )
 		{
@@ -885,28 +1384,173 @@ void DirDiffForm::applyFilters()
 	}
 
 	ui->multilistview->setSelectedRows(new_selection);
+
+	// Only rows that changed visibility, selection or place on screen change tier
+	for ( std::size_t i = 0; i < toggled.size(); ++i )
+	{
+		schedule_row(toggled[i]);
+	}
+
+	selection_changed();
+	viewport_changed();
 }
 
-void DirDiffForm::items_compared(
-	const QString& first_,
-	const QString& second_,
-	bool           equal
-)
+bool DirDiffForm::comparable(std::size_t i) const
+{
+	return list[i].name[0] != 0 && list[i].name[1] != 0 && ( list[i].res == NOT_COMPARED || list[i].res == PROBABLY_SAME ) && list[i].job == 0;
+}
+
+/// Cost of comparing a row whose size is not known. Ordered among files of a typical size
+const long long unknown_size_cost = 1024 * 1024;
+
+void DirDiffForm::schedule_row(std::size_t i)
+{
+	if ( !comparable(i) )
+	{
+		scheduler.cancel(i);
+
+		return;
+	}
+
+	CompareScheduler::tier t = CompareScheduler::TIER_SHOWN;
+
+	if ( ui->multilistview->isRowSelected(i) )
+	{
+		t = CompareScheduler::TIER_SELECTED;
+	}
+	else if ( list[i].res == PROBABLY_SAME )
+	{
+		t = CompareScheduler::TIER_VERIFY;
+	}
+	else if ( hidden(i) )
+	{
+		t = CompareScheduler::TIER_HIDDEN;
+	}
+	else if ( static_cast< int >( i ) >= onscreen_first && static_cast< int >( i ) <= onscreen_last )
+	{
+		t = CompareScheduler::TIER_ONSCREEN;
+	}
+
+	// Small files are answered sooner. Sizes the scan didn't record are not looked up here
+	scheduler.schedule(i, t, list[i].size < 0 ? unknown_size_cost : list[i].size);
+}
+
+void DirDiffForm::reschedule()
 {
+	ui->multilistview->visibleRows(onscreen_first, onscreen_last);
+	scheduled_selection = ui->multilistview->selectedRows();
 
-	const std::string first  = qt::convert(first_);
-	const std::string second = qt::convert(second_);
+	scheduler.reset( list.size() );
 
 	for ( std::size_t i = 0, n = list.size(); i < n; ++i )
 	{
-		if ( section_tree[0].name() + "/" + list[i].items[0] == first && section_tree[1].name() + "/" + list[i].items[1] == second )
+		schedule_row(i);
+	}
+}
+
+void DirDiffForm::viewport_changed()
+{
+	const int old_first = onscreen_first;
+	const int old_last  = onscreen_last;
+
+	ui->multilistview->visibleRows(onscreen_first, onscreen_last);
+
+	// Rows that left the screen, and rows that came onto it
+	const int n = static_cast< int >( list.size() );
+
+	for ( int i = std::max(old_first, 0); i <= old_last && i < n; ++i )
+	{
+		schedule_row(i);
+	}
+
+	for ( int i = std::max(onscreen_first, 0); i <= onscreen_last && i < n; ++i )
+	{
+		schedule_row(i);
+	}
+}
+
+void DirDiffForm::selection_changed()
+{
+	const QList< int > old_selection = scheduled_selection;
+
+	scheduled_selection = ui->multilistview->selectedRows();
+
+	const int n = static_cast< int >( list.size() );
+
+	for ( int i = 0; i < old_selection.count(); ++i )
+	{
+		if ( old_selection.at(i) >= 0 && old_selection.at(i) < n )
 		{
-			list[i].res = equal ? COMPARED_SAME : COMPARED_DIFFERENT;
-			applyFilters();
-			break;
+			schedule_row( old_selection.at(i) );
 		}
 	}
 
+	for ( int i = 0; i < scheduled_selection.count(); ++i )
+	{
+		if ( scheduled_selection.at(i) >= 0 && scheduled_selection.at(i) < n )
+		{
+			schedule_row( scheduled_selection.at(i) );
+		}
+	}
+}
+
+void DirDiffForm::update_row(std::size_t i)
+{
+	const bool hideitem = hidden(i);
+
+	ui->multilistview->style(i, list[i].ignore, list[i].unmatched(), list[i].res != NOT_COMPARED, list[i].res == COMPARED_SAME || list[i].res == PROBABLY_SAME, list[i].res == PROBABLY_SAME, list[i].moved);
+	ui->multilistview->setRowHidden(i, hideitem);
+
+	// Hiding a selected row moves the selection, which needs the whole list
+	if ( hideitem && ui->multilistview->isRowSelected(i) )
+	{
+		applyFilters();
+	}
+}
+
+void DirDiffForm::map_job_rows()
+{
+	job_rows.clear();
+
+	for ( std::size_t i = 0, n = list.size(); i < n; ++i )
+	{
+		if ( list[i].job != 0 )
+		{
+			job_rows[list[i].job] = i;
+		}
+	}
+}
+
+void DirDiffForm::items_compared(
+	unsigned long long     id,
+	bool                   equal,
+	pbl::fs::file_identity left,
+	pbl::fs::file_identity right
+)
+{
+	// Results for rows that have since been removed are dropped
+	std::map< unsigned long long, std::size_t >::iterator it = job_rows.find(id);
+
+	if ( it != job_rows.end() )
+	{
+		const std::size_t i = it->second;
+
+		job_rows.erase(it);
+
+		list[i].job         = 0;
+		list[i].res         = equal ? COMPARED_SAME : COMPARED_DIFFERENT;
+		list[i].identity[0] = left;
+		list[i].identity[1] = right;
+
+		// So the row is scheduled by size if it has to be compared again
+		if ( list[i].size < 0 && left.mtime_ns != -1 )
+		{
+			list[i].size = left.size;
+		}
+
+		update_row(i);
+	}
+
 	startComparison();
 }
 
@@ -1007,7 +1651,7 @@ void DirDiffForm::on_actionCopy_To_Clipboard_triggered()
 		if ( !hidden(i) )
 		{
 			// items
-			ts << qt::convert(list[i].items[0]) << '\t' << qt::convert(list[i].items[1]) << '\t';
+			ts << qt::convert( list[i].item(names, 0) ) << '\t' << qt::convert( list[i].item(names, 1) ) << '\t';
 
 			// result of comparison
 			if ( list[i].has_only(0) )
@@ -1020,10 +1664,18 @@ void DirDiffForm::on_actionCopy_To_Clipboard_triggered()
 			}
 			else if ( list[i].res != NOT_COMPARED )
 			{
-				if ( list[i].res == COMPARED_SAME )
+				if ( list[i].moved )
+				{
+					ts << "Moved";
+				}
+				else if ( list[i].res == COMPARED_SAME )
 				{
 					ts << "Same";
 				}
+				else if ( list[i].res == PROBABLY_SAME )
+				{
+					ts << "Probably Same";
+				}
 				else
 				{
 					ts << "Different";
@@ -1052,26 +1704,37 @@ void DirDiffForm::startComparison()
 {
 	if ( section_tree[0].valid() && section_tree[1].valid() )
 	{
-		const std::size_t n = list.size();
-		std::size_t       j = n;
+		MySettings& settings = MySettings::instance();
+
+		const long long limit  = settings.getFileSizeCompareLimit();
+		const bool      sample = settings.getSampledCompare();
+
+		std::size_t i = 0;
 
-		for ( std::size_t i = 0; i < n; ++i )
+		while ( scheduler.top(i) )
 		{
-			if ( !list[i].items[0].empty() && !list[i].items[1].empty() && list[i].res == NOT_COMPARED )
+			if ( i < list.size() && comparable(i) )
 			{
-				j = i;
+				const CompareQueue::job j =
+				{
+					next_job,
+					qt::convert(section_tree[0].name() + "/" + list[i].item(names, 0)),
+					qt::convert(section_tree[1].name() + "/" + list[i].item(names, 1)),
+					qt::convert( names.str(list[i].command[0]) ), qt::convert( names.str(list[i].command[1]) ),
+					limit, sample, list[i].res == PROBABLY_SAME
+				};
 
-				if ( !hidden(i) )
+				if ( !compare_queue.push(j) )
 				{
-					break;
+					// Queue is full. More will be added as results come in
+					return;
 				}
+
+				list[i].job           = next_job++;
+				job_rows[list[i].job] = i;
 			}
-		}
 
-		if ( j < n )
-		{
-			MySettings& settings = MySettings::instance();
-			emit        compare_files( qt::convert(section_tree[0].name() + "/" + list[j].items[0]), qt::convert(section_tree[1].name() + "/" + list[j].items[1]), qt::convert(list[j].command[0]), qt::convert(list[j].command[1]), settings.getFileSizeCompareLimit() );
+			scheduler.pop();
 		}
 	}
 }
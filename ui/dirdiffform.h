@@ -29,6 +29,7 @@
 #ifndef DIRDIFFFORM_H
 #define DIRDIFFFORM_H
 
+#include <map>
 #include <set>
 
 #include <QMap>
@@ -43,8 +44,13 @@ class QString;
 class QFileSystemWatcher;
 
 #include "filecompare.h"
+#include "comparescheduler.h"
 #include "comparisonlist.h"
+#include "treevalidator.h"
+#include "movedetector.h"
 #include "pbl/fileutil/directorycontents.h"
+#include "pbl/fileutil/hashcache.h"
+#include "pbl/fileutil/asyncreader.h"
 
 namespace Ui
 {
@@ -81,8 +87,6 @@ public:
 	void setFlags(bool show_left_only, bool show_right_only, bool show_identical);
 public slots:
 	void settingsChanged();
-signals:
-	void compare_files(const QString&, const QString&, const QString&, const QString&, int);
 private slots:
 	void on_viewdiff_clicked();
 	void on_copytoright_clicked();
@@ -123,11 +127,12 @@ private slots:
 	void on_actionCopy_To_Clipboard_triggered();
 
 	/** Respond to the worker when it has finished comparing two items
-	 * @param l The identifier of the left item
-	 * @param r The identifier of the right item
+	 * @param id The id of the job, as assigned by startComparison
 	 * @param same True iff items compared "the same"
+	 * @param left Identity of the left item when it was compared
+	 * @param right Identity of the right item when it was compared
 	 */
-	void items_compared(const QString& l, const QString& r, bool same);
+	void items_compared(unsigned long long id, bool same, pbl::fs::file_identity left, pbl::fs::file_identity right);
 	void on_actionSelect_Different_triggered();
 
 	void on_actionSelect_Same_triggered();
@@ -136,6 +141,25 @@ private slots:
 
 	void on_actionSelect_Right_Only_triggered();
 	void on_depthlimit_toggled(bool checked);
+
+	/** Compare rows that have scrolled into view sooner
+	 */
+	void viewport_changed();
+
+	/** Compare selected rows sooner
+	 */
+	void selection_changed();
+
+	/** Use the trees from the validator, now that it has finished
+	 *
+	 * Results from the snapshots are dropped unless the files are unchanged.
+	 */
+	void trees_validated();
+
+	/** Pair up the moved files that the detector found, now that it has
+	 * finished
+	 */
+	void moves_detected();
 private:
 	enum overwrite_t {OVERWRITE_ASK, OVERWRITE_YES, OVERWRITE_NO};
 
@@ -147,6 +171,27 @@ private:
 
 	void applyFilters();
 
+	/** Restyle and show/hide a single row, after its comparison finished
+	 */
+	void update_row(std::size_t);
+
+	/** Find the rows of queued comparisons, after rows have moved
+	 */
+	void map_job_rows();
+
+	/** Check if a row has two items that still need to be compared
+	 */
+	bool comparable(std::size_t) const;
+
+	/** Schedule a row in the right tier, or cancel it if it doesn't need
+	 * to be compared
+	 */
+	void schedule_row(std::size_t);
+
+	/** Schedule every row again, ex., after rows moved
+	 */
+	void reschedule();
+
 	void show_only_section(std::size_t, bool checked);
 
 	/** The "show ignored" checkbox was toggled
@@ -170,6 +215,11 @@ private:
 	void change_depth();
 	void open_section(std::size_t);
 	void change_dir(const std::string&, const std::string&);
+
+	/** Tell both trees what to record and what to leave out when scanning,
+	 * from MySettings
+	 */
+	void apply_scan_settings();
 	void find_subdirs(QStringList& subdirs, const DirectoryContents& n, const std::string&, int, int);
 	QStringList find_subdirs(const DirectoryContents&, int);
 	void refresh();
@@ -177,20 +227,87 @@ private:
 	void explore_section(std::size_t);
 	void select_section_only(std::size_t);
 
-	void file_list_changed(int depth, bool);
+	/** Match the trees again, and update the view
+	 * @param rootchanged Drop all rows, rather than keep the ones that still match
+	 * @param recheck Also drop results for rows whose files' metadata wasn't recorded
+	 */
+	void file_list_changed(int depth, bool rootchanged, bool recheck);
 
-	/** Start a worker thread for comparing matched items
+	/** Queue matched items for the comparison workers
 	 */
 	void startComparison();
 
+	/** Start the pool of comparison threads, as configured in MySettings
+	 */
+	void start_workers();
+
+	/** Stop the comparison threads, discarding queued comparisons
+	 */
+	void stop_workers();
+
 	/** Check if an item should be hidden, according to current view options
 	 */
 	bool hidden(std::size_t) const;
 
+	/** Check if both items in a row are the same as when they were compared
+	 * @param scanned The row as matched from the trees' latest scan
+	 */
+	bool unchanged(std::size_t, const comparison_t& scanned) const;
+
+	/** File that a tree's snapshot is saved in, or empty if there is none
+	 */
+	std::string snapshot_path(const DirectoryContents&) const;
+
+	/** Save both trees, if snapshots are enabled
+	 */
+	void save_snapshots();
+
+	/** Stop bringing trees loaded from snapshots up to date, before the trees
+	 * are changed
+	 */
+	void cancel_validation();
+
+	/** Start bringing the trees up to date in the background, if they came
+	 * from snapshots
+	 */
+	void start_validation(int depth);
+
+	/** Stop looking for moved files, before the list is changed
+	 */
+	void cancel_move_detection();
+
+	/** Start looking for moved files among the unmatched rows, if enabled
+	 */
+	void start_move_detection();
+
 	/// Pointer to UI class c/o Qt Creator
 	Ui::DirDiffForm* ui;
 
-	QThread compare_thread;
+	/// Comparisons waiting for a worker
+	CompareQueue compare_queue;
+
+	/// Threads running the FileCompare workers
+	std::vector< QThread* > compare_threads;
+
+	/// Hashes of files that have already been compared
+	pbl::fs::HashCache hash_cache;
+
+	/// Reads files ahead of the workers, if enabled. Shared by all of them
+	pbl::fs::AsyncReader* reader;
+
+	/// Id for the next comparison that is queued. 0 is never used
+	unsigned long long next_job;
+
+	/// Rows of comparisons that have been queued, but not yet answered
+	std::map< unsigned long long, std::size_t > job_rows;
+
+	/// Rows that have yet to be queued, in the order they should be compared
+	CompareScheduler scheduler;
+
+	/// Rows that were on screen, and selected, when last scheduled
+	int          onscreen_first;
+	int          onscreen_last;
+	QList< int > scheduled_selection;
 
 	/// A filter for which items to show
 	QVector< QRegExp > filters;
@@ -208,6 +325,24 @@ private:
 
 	DirectoryContents section_tree[2];
 
+	/// Set when the trees were loaded from snapshots and not yet validated
+	bool unvalidated;
+
+	/// Validating the trees in the background, if not null
+	TreeValidator* validator;
+
+	/// Directories that changed while validating, to be rescanned after
+	std::vector< std::string > changed_while_validating;
+
+	/// Looking for moved files in the background, if not null
+	MoveDetector* detector;
+
+	/// Names of the items in list
+	PathPool names;
+
+	/// Size of names when it last held only the names of list
+	std::size_t names_used;
+
 	std::vector< comparison_t > list;
 	/*
 	   DirectoryComparison derp;
@@ -28,16 +28,118 @@
  */
 #include "filecompare.h"
 
+#include <algorithm>
 #include <cstdio>
 
 #include <QProcess>
 #include <QFile>
+#include <QMutexLocker>
 
 #include "pbl/fileutil/compare.h"
+#include "pbl/fileutil/hashcache.h"
 #include "qutility/convert.h"
 
+#if defined( __linux__ )
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined( SYS_ioprio_get ) && defined( SYS_ioprio_set )
+#define PBL_IOPRIO
+#endif
+#endif
+
 namespace
 {
+/** Files that differ are hashed in full only if it costs little more than
+ * the comparison did: the rest of the file is at most this many bytes, or at
+ * most as much as was already read
+ */
+const long long finish_hash_bytes = 8 * 1024 * 1024;
+
+/** Whether a file still has the identity it had before it was read
+ */
+bool unchanged(
+	const std::string&            path,
+	const pbl::fs::file_identity& id
+)
+{
+	pbl::fs::file_identity now;
+
+	return pbl::fs::get_identity(path, now) && now == id;
+}
+
+/** Hash a file that was found to differ, so the cache can answer for it
+ * next time
+ * @param read Bytes of the file that were read while comparing
+ */
+void finish_hash(
+	pbl::fs::HashCache&            cache,
+	const QString&                 filename,
+	const pbl::fs::file_identity&  id,
+	long long                      read,
+	const pbl::cancellation_token& cancel
+)
+{
+	pbl::fs::content_hash h;
+
+	if ( id.size - read <= std::max(read, finish_hash_bytes) )
+	{
+		const std::string path = qt::convert(filename);
+
+		// Don't store a hash of a file that changed while it was read
+		if ( pbl::fs::hash_file(path, 0, cancel, h) && unchanged(path, id) )
+		{
+			cache.insert(id, h);
+		}
+	}
+}
+
+/** Lower the I/O priority of the calling thread to idle, while in scope
+ *
+ * Only Linux lets a thread have its own I/O priority; elsewhere this does
+ * nothing.
+ */
+class IdleIOPriority
+{
+public:
+	explicit IdleIOPriority(bool enable)
+		: previous(-1)
+	{
+		if ( enable )
+		{
+			#ifdef PBL_IOPRIO
+			// Who is the calling thread, class is idle (3)
+			previous = static_cast< int >( ::syscall(SYS_ioprio_get, ioprio_who_process, 0) );
+
+			if ( previous != -1 && ::syscall(SYS_ioprio_set, ioprio_who_process, 0, 3 << ioprio_class_shift) != 0 )
+			{
+				previous = -1;
+			}
+			#endif
+		}
+	}
+
+	~IdleIOPriority()
+	{
+		#ifdef PBL_IOPRIO
+		if ( previous != -1 )
+		{
+			::syscall(SYS_ioprio_set, ioprio_who_process, 0, previous);
+		}
+		#endif
+	}
+private:
+	IdleIOPriority(const IdleIOPriority&);
+	IdleIOPriority& operator=(const IdleIOPriority&);
+
+	#ifdef PBL_IOPRIO
+	static const int ioprio_who_process = 1;
+	static const int ioprio_class_shift = 13;
+	#endif
+
+	/// Priority to restore, or -1
+	int previous;
+};
+
 class FileOrProcess
 {
 public:
@@ -82,18 +184,177 @@ private:
 };
 }
 
-void FileCompare::compare(
-	const QString& first,
-	const QString& second,
-	const QString& lcommand,
-	const QString& rcommand,
-	long long      filesizelimit // in megabytes
+CompareQueue::CompareQueue(std::size_t capacity_)
+	: capacity(capacity_), closed(false)
+{
+}
+
+void CompareQueue::setCapacity(std::size_t n)
+{
+	QMutexLocker lock(&mutex);
+
+	capacity = n;
+}
+
+bool CompareQueue::push(const job& j)
+{
+	QMutexLocker lock(&mutex);
+
+	if ( closed || jobs.size() >= capacity )
+	{
+		return false;
+	}
+
+	jobs.push_back(j);
+	jobs.back().cancel = cancel_source.token();
+	not_empty.wakeOne();
+
+	return true;
+}
+
+bool CompareQueue::pop(job& j)
+{
+	QMutexLocker lock(&mutex);
+
+	while ( !closed && jobs.empty() )
+	{
+		not_empty.wait(&mutex);
+	}
+
+	if ( closed )
+	{
+		return false;
+	}
+
+	j = jobs.front();
+	jobs.pop_front();
+
+	return true;
+}
+
+void CompareQueue::cancel()
+{
+	QMutexLocker lock(&mutex);
+
+	jobs.clear();
+	cancel_source.cancel();
+}
+
+void CompareQueue::close()
+{
+	QMutexLocker lock(&mutex);
+
+	closed = true;
+	jobs.clear();
+	cancel_source.cancel();
+	not_empty.wakeAll();
+}
+
+void CompareQueue::reopen()
+{
+	QMutexLocker lock(&mutex);
+
+	closed = false;
+}
+
+FileCompare::FileCompare(
+	CompareQueue*         queue_,
+	pbl::fs::HashCache*   cache_,
+	pbl::fs::AsyncReader* reader_
 )
+	: queue(queue_), cache(cache_), reader(reader_)
+{
+}
+
+void FileCompare::run()
 {
-	FileOrProcess file1(first, lcommand);
-	FileOrProcess file2(second, rcommand);
+	CompareQueue::job j;
 
-	const bool res = ( pbl::fs::compare(file1.handle(), file2.handle(), filesizelimit * 1024 * 1024) == pbl::fs::compare_equal );
+	while ( queue->pop(j) )
+	{
+		pbl::fs::file_identity id1;
+		pbl::fs::file_identity id2;
+
+		const bool res = compare(j, id1, id2);
+
+		// Nobody is waiting for the result of a cancelled job
+		if ( !j.cancel.cancelled() )
+		{
+			emit compared(j.id, res, id1, id2);
+		}
+	}
+}
+
+bool FileCompare::compare(
+	const CompareQueue::job& j,
+	pbl::fs::file_identity&  id1,
+	pbl::fs::file_identity&  id2
+)
+{
+	// So the form can tell later if the result still holds
+	const bool known1 = pbl::fs::get_identity(qt::convert(j.first), id1);
+	const bool known2 = pbl::fs::get_identity(qt::convert(j.second), id2);
+
+	if ( !known1 )
+	{
+		id1.mtime_ns = -1;
+	}
+
+	if ( !known2 )
+	{
+		id2.mtime_ns = -1;
+	}
+
+	/* Files that are compared directly can be answered from the cache, if
+	 * neither has changed since it was last hashed
+	 */
+	const bool cacheable = cache && j.lcommand.isEmpty() && j.rcommand.isEmpty() && known1 && known2;
+
+	if ( cacheable )
+	{
+		pbl::fs::content_hash h1;
+		pbl::fs::content_hash h2;
+
+		if ( cache->find(id1, h1) && cache->find(id2, h2) )
+		{
+			return h1 == h2;
+		}
+	}
+
+	FileOrProcess file1(j.first, j.lcommand);
+	FileOrProcess file2(j.second, j.rcommand);
+
+	pbl::fs::compare_options options;
+	options.sizelimit = j.filesizelimit * 1024 * 1024;
+	options.sample    = j.sample;
+	options.reader    = j.background ? 0 : reader; // its threads would read at normal priority
+	options.cancel    = j.cancel;
+
+	const IdleIOPriority idle(j.background);
+
+	pbl::fs::content_hash hash       = { 0, 0, -1 };
+	long long             difference = 0;
+
+	const pbl::fs::compare_result res = pbl::fs::compare(file1.handle(), file2.handle(), options, &difference, cacheable ? &hash : 0);
+
+	if ( cacheable )
+	{
+		if ( res == pbl::fs::compare_equal )
+		{
+			// Either file may have changed while it was read
+			if ( unchanged(qt::convert(j.first), id1) && unchanged(qt::convert(j.second), id2) )
+			{
+				cache->insert(id1, hash);
+				cache->insert(id2, hash);
+			}
+		}
+		else if ( res == pbl::fs::compare_notequal_content )
+		{
+			// Files of different sizes are told apart without the cache
+			finish_hash(*cache, j.first, id1, difference, j.cancel);
+			finish_hash(*cache, j.second, id2, difference, j.cancel);
+		}
+	}
 
-	emit compared(first, second, res);
+	return res == pbl::fs::compare_equal;
 }
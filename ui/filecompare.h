@@ -29,18 +29,117 @@
 #ifndef FILECOMPARE_H
 #define FILECOMPARE_H
 
+#include <deque>
+
 #include <QObject>
+#include <QMetaType>
 #include <QString>
 #include <QByteArray>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "pbl/fileutil/hashcache.h"
+#include "pbl/util/cancellation.h"
+
+namespace pbl
+{
+namespace fs
+{
+class AsyncReader;
+}
+}
+
+// Passed between threads by FileCompare::compared
+Q_DECLARE_METATYPE(pbl::fs::file_identity)
+
+/** A bounded queue of comparisons shared by a pool of FileCompare workers
+ */
+class CompareQueue
+{
+public:
+	struct job
+	{
+		unsigned long long      id;            // identifies the result
+		QString                 first;
+		QString                 second;
+		QString                 lcommand;
+		QString                 rcommand;
+		long long               filesizelimit; // in megabytes
+		bool                    sample;        // probe a few blocks before reading in full
+		bool                    background;    // read at idle I/O priority
+		pbl::cancellation_token cancel;        // set by push()
+	};
+
+	explicit CompareQueue(std::size_t capacity);
+
+	/** Change the number of jobs that may be waiting at any one time
+	 */
+	void setCapacity(std::size_t);
+
+	/** Add a job without blocking
+	 *
+	 * The job can be cancelled, while it waits or while it runs, by cancel()
+	 * or close().
+	 *
+	 * @returns false if the queue is full or closed
+	 */
+	bool push(const job&);
+
+	/** Wait for a job
+	 * @returns false once the queue has been closed
+	 */
+	bool pop(job&);
+
+	/** Discard waiting jobs, and stop the ones that are running
+	 */
+	void cancel();
+
+	/** Cancel all jobs and wake all workers so they can exit
+	 */
+	void close();
+
+	/** Accept jobs again after a close()
+	 */
+	void reopen();
+private:
+	QMutex            mutex;
+	QWaitCondition    not_empty;
+	std::deque< job > jobs;
+	std::size_t       capacity;
+	bool              closed;
+
+	pbl::cancellation_source cancel_source;
+};
 
 class FileCompare
 	: public QObject
 {
 	Q_OBJECT
+public:
+	/** Create a worker for the given queue
+	 * @param cache Hashes of previously compared files. May be null
+	 * @param reader Reads regular files ahead of the comparison. May be null
+	 */
+	FileCompare(CompareQueue*, pbl::fs::HashCache* cache, pbl::fs::AsyncReader* reader);
 public slots:
-	void compare(const QString& first, const QString& second, const QString&, const QString&, long long);
+	/** Compare items from the queue until it is closed
+	 */
+	void run();
 signals:
-	void compared(const QString& first, const QString& second, bool);
+	/** A comparison has finished
+	 * @param id The id of the job
+	 * @param same True iff the items compared "the same"
+	 * @param first Identity of the first item when it was compared. Its
+	 *   mtime_ns is -1 if the item could not be stat-ed
+	 * @param second Identity of the second item
+	 */
+	void compared(unsigned long long id, bool same, pbl::fs::file_identity first, pbl::fs::file_identity second);
+private:
+	bool compare(const CompareQueue::job&, pbl::fs::file_identity&, pbl::fs::file_identity&);
+
+	CompareQueue*         queue;
+	pbl::fs::HashCache*   cache;
+	pbl::fs::AsyncReader* reader;
 };
 
 #endif // FILECOMPARE_H
@@ -34,7 +34,15 @@
 FileNameMatcher::FileNameMatcher(const std::vector< FileNameMatcher::match_descriptor >& conditions_)
 	: conditions(conditions_)
 {
+	for ( std::size_t i = 0; i < conditions.size(); ++i )
+	{
+		QRegularExpression pattern("^" + conditions[i].pattern + "$");
+		pattern.optimize();
+		patterns.push_back(pattern);
 
+		const match_result t = { conditions[i].weight, conditions[i].first_command.toStdString(), conditions[i].second_command.toStdString() };
+		results.push_back(t);
+	}
 }
 
 FileNameMatcher::match_result FileNameMatcher::operator()(
@@ -59,6 +67,32 @@ FileNameMatcher::match_result FileNameMatcher::operator()(
 	return ( res1.weight < res2.weight ) ? res1 : res2;
 }
 
+std::vector< FileNameMatcher::rewrite > FileNameMatcher::rewrites(const std::string& a) const
+{
+	std::vector< rewrite > v;
+
+	if ( conditions.empty() )
+	{
+		return v;
+	}
+
+	const QString s = QString::fromStdString(a);
+
+	for ( std::size_t i = 0; i < conditions.size(); ++i )
+	{
+		if ( patterns[i].match(s).hasMatch() )
+		{
+			QString b2 = s;
+			b2.replace(patterns[i], conditions[i].replacement);
+
+			const rewrite t = { b2.toStdString(), results[i] };
+			v.push_back(t);
+		}
+	}
+
+	return v;
+}
+
 FileNameMatcher::match_result FileNameMatcher::compare_inner(
 	const std::string& a,
 	const std::string& b
@@ -66,33 +100,22 @@ FileNameMatcher::match_result FileNameMatcher::compare_inner(
 {
 	std::size_t best = static_cast< std::size_t >( -1 );
 
-	for ( std::size_t i = 0; i < conditions.size(); ++i )
-	{
-		QRegularExpression pattern("^" + conditions[i].pattern + "$");
-
-		QRegularExpressionMatch match = pattern.match( QString::fromStdString(a) );
+	const std::vector< rewrite > v = rewrites(a);
 
-		if ( match.hasMatch() )
+	for ( std::size_t i = 0; i < v.size(); ++i )
+	{
+		if ( v[i].name == b )
 		{
-			QString replace = conditions[i].replacement;
-
-			QString b2 = QString::fromStdString(a);
-			b2.replace(pattern, replace);
-
-			if ( b2.toStdString() == b )
+			if ( best == static_cast< std::size_t >( -1 ) || v[i].result.weight < v[best].result.weight )
 			{
-				if ( best == static_cast< std::size_t >( -1 ) || conditions[i].weight < conditions[best].weight )
-				{
-					best = i;
-				}
+				best = i;
 			}
 		}
 	}
 
 	if ( best != static_cast< std::size_t >( -1 ) )
 	{
-		match_result t = { conditions[best].weight, conditions[best].first_command.toStdString(), conditions[best].second_command.toStdString() };
-		return t;
+		return v[best].result;
 	}
 	else
 	{
@@ -32,6 +32,7 @@
 #include <string>
 #include <vector>
 
+#include <QRegularExpression>
 #include <QString>
 
 class FileNameMatcher
@@ -53,12 +54,32 @@ public:
 		int weight;
 	};
 
+	/** A name that a file can be matched to, and the rule that does it
+	 */
+	struct rewrite
+	{
+		std::string name;
+		match_result result;
+	};
+
 	explicit FileNameMatcher(const std::vector< match_descriptor >&);
 
 	match_result operator()(const std::string& a, const std::string& b) const;
+
+	/** Apply every rule whose pattern matches a name, in order
+	 *
+	 * Much cheaper than calling operator() with each name it might match.
+	 */
+	std::vector< rewrite > rewrites(const std::string&) const;
 private:
 	match_result compare_inner(const std::string& a, const std::string& b) const;
 	std::vector< match_descriptor > conditions;
+
+	/// Each condition's pattern, compiled once
+	std::vector< QRegularExpression > patterns;
+
+	/// Each condition's result, if it matches
+	std::vector< match_result > results;
 };
 
 
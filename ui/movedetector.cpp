@@ -0,0 +1,386 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "movedetector.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "pbl/fileutil/compare.h"
+
+namespace
+{
+/// Bytes hashed from the start of each file, before any is read in full
+const std::size_t head_size = 64 * 1024;
+
+/// Order by size, then by hash
+bool hash_less(
+	const pbl::fs::content_hash& a,
+	const pbl::fs::content_hash& b
+)
+{
+	if ( a.size != b.size )
+	{
+		return a.size < b.size;
+	}
+
+	if ( a.h1 != b.h1 )
+	{
+		return a.h1 < b.h1;
+	}
+
+	return a.h2 < b.h2;
+}
+
+std::string file_name(const std::string& path)
+{
+	const std::string::size_type i = path.rfind('/');
+
+	return i == std::string::npos ? path : path.substr(i + 1);
+}
+
+}
+
+bool MoveDetector::orphan::operator<(const orphan& o) const
+{
+	if ( size != o.size )
+	{
+		return size < o.size;
+	}
+
+	if ( head != o.head )
+	{
+		return hash_less(head, o.head);
+	}
+
+	return index < o.index;
+}
+
+MoveDetector::MoveDetector(
+	const std::string&                lroot,
+	const std::string&                rroot,
+	const std::vector< std::string >& left,
+	const std::vector< std::string >& right,
+	long long                         sizelimit,
+	pbl::fs::HashCache*               cache_,
+	QObject*                          parent_
+)
+	: QThread(parent_), limit(sizelimit), cache(cache_), token( cancel_source.token() )
+{
+	roots[0] = lroot;
+	roots[1] = rroot;
+	files[0] = left;
+	files[1] = right;
+}
+
+void MoveDetector::cancel()
+{
+	cancel_source.cancel();
+}
+
+bool MoveDetector::cancelled() const
+{
+	return token.cancelled();
+}
+
+const std::vector< MoveDetector::move >& MoveDetector::moves() const
+{
+	return found;
+}
+
+void MoveDetector::run()
+{
+	std::vector< orphan > v[2];
+
+	for ( std::size_t i = 0; i < 2; ++i )
+	{
+		find_sizes(i, v[i]);
+	}
+
+	// Most files are ruled out by size alone, without being opened
+	keep_common_sizes(v[0], v[1]);
+
+	for ( std::size_t i = 0; i < 2; ++i )
+	{
+		hash_heads(i, v[i]);
+	}
+
+	pair(v[0], v[1]);
+}
+
+void MoveDetector::find_sizes(
+	std::size_t            side,
+	std::vector< orphan >& v
+) const
+{
+	for ( std::size_t i = 0; i < files[side].size() && !token.cancelled(); ++i )
+	{
+		orphan o = { 0, { 0, 0, -1 }, i, pbl::fs::file_identity() };
+
+		// Empty files are all the same, so they say nothing about moves
+		if ( pbl::fs::get_identity(roots[side] + "/" + files[side][i], o.identity)
+		     && o.identity.size > 0 && ( limit == 0 || o.identity.size <= limit ) )
+		{
+			o.size = o.identity.size;
+			v.push_back(o);
+		}
+	}
+
+	std::sort( v.begin(), v.end() );
+}
+
+void MoveDetector::keep_common_sizes(
+	std::vector< orphan >& l,
+	std::vector< orphan >& r
+)
+{
+	std::vector< orphan > kl;
+	std::vector< orphan > kr;
+
+	for ( std::size_t i = 0, j = 0; i < l.size() && j < r.size();)
+	{
+		if ( l[i].size < r[j].size )
+		{
+			++i;
+		}
+		else if ( r[j].size < l[i].size )
+		{
+			++j;
+		}
+		else
+		{
+			const long long s = l[i].size;
+
+			for (; i < l.size() && l[i].size == s; ++i )
+			{
+				kl.push_back(l[i]);
+			}
+
+			for (; j < r.size() && r[j].size == s; ++j )
+			{
+				kr.push_back(r[j]);
+			}
+		}
+	}
+
+	l.swap(kl);
+	r.swap(kr);
+}
+
+void MoveDetector::hash_heads(
+	std::size_t            side,
+	std::vector< orphan >& v
+) const
+{
+	std::vector< orphan > k;
+
+	for ( std::size_t i = 0; i < v.size() && !token.cancelled(); ++i )
+	{
+		if ( pbl::fs::hash_file(roots[side] + "/" + files[side][v[i].index], head_size, token, v[i].head) )
+		{
+			k.push_back(v[i]);
+		}
+	}
+
+	std::sort( k.begin(), k.end() );
+	v.swap(k);
+}
+
+void MoveDetector::pair(
+	const std::vector< orphan >& l,
+	const std::vector< orphan >& r
+)
+{
+	std::size_t i = 0;
+	std::size_t j = 0;
+
+	while ( i < l.size() && j < r.size() && !token.cancelled() )
+	{
+		if ( l[i].size != r[j].size || l[i].head != r[j].head )
+		{
+			if ( l[i].size < r[j].size || ( l[i].size == r[j].size && hash_less(l[i].head, r[j].head) ) )
+			{
+				++i;
+			}
+			else
+			{
+				++j;
+			}
+		}
+		else
+		{
+			// Files with the same size and first block, on both sides
+			std::vector< orphan > gl;
+			std::vector< orphan > gr;
+
+			for ( const orphan& o = l[i]; i < l.size() && l[i].size == o.size && l[i].head == o.head; ++i )
+			{
+				gl.push_back(l[i]);
+			}
+
+			for ( const orphan& o = r[j]; j < r.size() && r[j].size == o.size && r[j].head == o.head; ++j )
+			{
+				gr.push_back(r[j]);
+			}
+
+			pair_group(gl, gr);
+		}
+	}
+}
+
+void MoveDetector::pair_group(
+	std::vector< orphan >& l,
+	std::vector< orphan >& r
+)
+{
+	if ( l.size() == 1 && r.size() == 1 )
+	{
+		confirm(l[0], r[0]);
+		return;
+	}
+
+	/* Rather than compare every pair, hash every file in full. Files are then
+	 * only compared to a file with the same hash, to rule out a collision.
+	 */
+	if ( !hash_all(0, l) || !hash_all(1, r) )
+	{
+		return;
+	}
+
+	std::vector< bool > taken(r.size(), false);
+
+	// Prefer a file with the same name, since it was probably moved
+	for ( std::size_t pass = 0; pass < 2; ++pass )
+	{
+		for ( std::size_t i = 0; i < l.size(); ++i )
+		{
+			if ( l[i].size < 0 )
+			{
+				continue;
+			}
+
+			const std::string name = file_name(files[0][l[i].index]);
+
+			for ( std::size_t j = 0; j < r.size(); ++j )
+			{
+				if ( !taken[j] && r[j].head == l[i].head
+				     && ( pass == 1 || file_name(files[1][r[j].index]) == name ) )
+				{
+					if ( confirm(l[i], r[j]) )
+					{
+						taken[j]  = true;
+						l[i].size = -1;
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+bool MoveDetector::hash_all(
+	std::size_t            side,
+	std::vector< orphan >& v
+) const
+{
+	for ( std::size_t i = 0; i < v.size(); ++i )
+	{
+		if ( token.cancelled() )
+		{
+			return false;
+		}
+
+		if ( cache && cache->find(v[i].identity, v[i].head) )
+		{
+			continue;
+		}
+
+		const std::string path = roots[side] + "/" + files[side][v[i].index];
+
+		if ( pbl::fs::hash_file(path, 0, token, v[i].head) )
+		{
+			pbl::fs::file_identity now;
+
+			// Don't store a hash of a file that changed while it was read
+			if ( cache && pbl::fs::get_identity(path, now) && now == v[i].identity )
+			{
+				cache->insert(v[i].identity, v[i].head);
+			}
+		}
+		else
+		{
+			// Matches nothing on the other side
+			v[i].head.size = -1 - static_cast< long long >( side );
+		}
+	}
+
+	return true;
+}
+
+bool MoveDetector::confirm(
+	const orphan& l,
+	const orphan& r
+)
+{
+	const std::string lpath = roots[0] + "/" + files[0][l.index];
+	const std::string rpath = roots[1] + "/" + files[1][r.index];
+
+	// Stops between blocks if the detector is cancelled
+	pbl::fs::compare_options options;
+	options.sizelimit = limit;
+	options.cancel    = token;
+
+	pbl::fs::compare_result res = pbl::fs::compare_error_open;
+
+	if ( std::FILE* fd1 = std::fopen(lpath.c_str(), "rb") )
+	{
+		if ( std::FILE* fd2 = std::fopen(rpath.c_str(), "rb") )
+		{
+			res = pbl::fs::compare(fd1, fd2, options);
+
+			std::fclose(fd2);
+		}
+
+		std::fclose(fd1);
+	}
+
+	if ( res != pbl::fs::compare_equal )
+	{
+		return false;
+	}
+
+	move m;
+
+	m.left        = files[0][l.index];
+	m.right       = files[1][r.index];
+	m.identity[0] = l.identity;
+	m.identity[1] = r.identity;
+	found.push_back(m);
+
+	return true;
+}
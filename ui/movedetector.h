@@ -0,0 +1,135 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef MOVEDETECTOR_H
+#define MOVEDETECTOR_H
+
+#include <string>
+#include <vector>
+
+#include <QThread>
+
+#include "pbl/fileutil/hashcache.h"
+#include "pbl/util/cancellation.h"
+
+/** Finds files that were moved or renamed, among files that are only on one
+ * side, in the background
+ *
+ * Files are grouped by size, then by a hash of their first block. Only files
+ * in the same group are compared in full. When done, finished() is emitted.
+ */
+class MoveDetector
+	: public QThread
+{
+	Q_OBJECT
+public:
+	/** A file on the left with the same contents as a file on the right
+	 */
+	struct move
+	{
+		std::string left;
+		std::string right;
+
+		/// The files, as they were when they were compared
+		pbl::fs::file_identity identity[2];
+	};
+
+	/**
+	 * @param lroot, rroot Directories that the paths are relative to
+	 * @param left, right Files that are only on the left, or only on the right
+	 * @param sizelimit Files larger than this many bytes are skipped. 0 for
+	 *   no limit
+	 * @param cache Used for full hashes of files, if not null
+	 */
+	MoveDetector(const std::string& lroot, const std::string& rroot, const std::vector< std::string >& left, const std::vector< std::string >& right, long long sizelimit, pbl::fs::HashCache* cache, QObject* parent);
+
+	/** Stop early. The moves should not be used
+	 */
+	void cancel();
+
+	bool cancelled() const;
+
+	/** Get the moves that were found, after the thread has finished
+	 */
+	const std::vector< move >& moves() const;
+protected:
+	void run();
+private:
+	/// A file that could have been moved
+	struct orphan
+	{
+		long long              size;
+		pbl::fs::content_hash  head; // hash of the first block
+		std::size_t            index;
+		pbl::fs::file_identity identity;
+
+		bool operator<(const orphan&) const;
+	};
+
+	/** Stat each file, and keep the ones that might be compared
+	 */
+	void find_sizes(std::size_t side, std::vector< orphan >&) const;
+
+	/** Drop files without a file of the same size on the other side
+	 */
+	static void keep_common_sizes(std::vector< orphan >&, std::vector< orphan >&);
+
+	/** Hash the first block of each file
+	 */
+	void hash_heads(std::size_t side, std::vector< orphan >&) const;
+
+	/** Pair up files with the same size and first block, whose whole
+	 * contents are equal
+	 */
+	void pair(const std::vector< orphan >&, const std::vector< orphan >&);
+
+	/** Pair up files from one group, with the same size and first block
+	 */
+	void pair_group(std::vector< orphan >&, std::vector< orphan >&);
+
+	/** Replace the hash of each file's first block with a hash of the whole
+	 * file
+	 * @returns false if cancelled
+	 */
+	bool hash_all(std::size_t side, std::vector< orphan >&) const;
+
+	/** Compare two files in full, and record a move if they are the same
+	 */
+	bool confirm(const orphan&, const orphan&);
+
+	std::string                roots[2];
+	std::vector< std::string > files[2];
+	long long                  limit;
+	pbl::fs::HashCache*        cache;
+	std::vector< move >        found;
+
+	pbl::cancellation_source      cancel_source;
+	const pbl::cancellation_token token;
+};
+
+#endif // MOVEDETECTOR_H
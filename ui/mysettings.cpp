@@ -36,6 +36,17 @@ const char editor_key[]        = "editor";
 const char filters_key[]       = "filters";
 const char matches_key[]       = "matchrules";
 const char compare_limit_key[] = "comparelimit";
+const char threads_key[]       = "comparethreads";
+const char queue_depth_key[]   = "comparequeuedepth";
+const char hash_cache_key[]    = "hashcache";
+const char sampled_key[]       = "sampledcompare";
+const char async_read_key[]    = "asyncread";
+const char snapshots_key[]     = "snapshots";
+const char scan_metadata_key[] = "scanmetadata";
+const char quick_compare_key[] = "quickcompare";
+const char ignore_rules_key[]  = "ignorerules";
+const char gitignore_key[]     = "gitignore";
+const char detect_moves_key[]  = "detectmoves";
 const char pattern_key[]       = "pattern";
 const char replace_key[]       = "replace";
 const char command1_key[]      = "command1";
@@ -112,6 +123,137 @@ void MySettings::setFileSizeCompareLimit(int x)
 	store->setValue(compare_limit_key, x);
 }
 
+int MySettings::getCompareThreads() const
+{
+	QVariant v = store->value(threads_key);
+
+	if ( !v.isNull() )
+	{
+		return v.toInt();
+	}
+
+	return 0;
+}
+
+void MySettings::setCompareThreads(int x)
+{
+	store->setValue(threads_key, x);
+}
+
+int MySettings::getCompareQueueDepth() const
+{
+	QVariant v = store->value(queue_depth_key);
+
+	if ( !v.isNull() )
+	{
+		return v.toInt();
+	}
+
+	return 2;
+}
+
+void MySettings::setCompareQueueDepth(int x)
+{
+	store->setValue(queue_depth_key, x);
+}
+
+bool MySettings::getHashCache() const
+{
+	QVariant v = store->value(hash_cache_key);
+
+	if ( !v.isNull() )
+	{
+		return v.toBool();
+	}
+
+	return true;
+}
+
+void MySettings::setHashCache(bool x)
+{
+	store->setValue(hash_cache_key, x);
+}
+
+bool MySettings::getSampledCompare() const
+{
+	return store->value(sampled_key).toBool();
+}
+
+void MySettings::setSampledCompare(bool x)
+{
+	store->setValue(sampled_key, x);
+}
+
+bool MySettings::getAsyncRead() const
+{
+	return store->value(async_read_key).toBool();
+}
+
+void MySettings::setAsyncRead(bool x)
+{
+	store->setValue(async_read_key, x);
+}
+
+bool MySettings::getSnapshots() const
+{
+	return store->value(snapshots_key).toBool();
+}
+
+void MySettings::setSnapshots(bool x)
+{
+	store->setValue(snapshots_key, x);
+}
+
+bool MySettings::getScanMetadata() const
+{
+	return store->value(scan_metadata_key).toBool();
+}
+
+void MySettings::setScanMetadata(bool x)
+{
+	store->setValue(scan_metadata_key, x);
+}
+
+bool MySettings::getQuickCompare() const
+{
+	return store->value(quick_compare_key).toBool();
+}
+
+void MySettings::setQuickCompare(bool x)
+{
+	store->setValue(quick_compare_key, x);
+}
+
+QStringList MySettings::getIgnoreRules() const
+{
+	return store->value(ignore_rules_key).toStringList();
+}
+
+void MySettings::setIgnoreRules(const QStringList& x)
+{
+	store->setValue(ignore_rules_key, x);
+}
+
+bool MySettings::getGitIgnore() const
+{
+	return store->value(gitignore_key).toBool();
+}
+
+void MySettings::setGitIgnore(bool x)
+{
+	store->setValue(gitignore_key, x);
+}
+
+bool MySettings::getDetectMoves() const
+{
+	return store->value(detect_moves_key).toBool();
+}
+
+void MySettings::setDetectMoves(bool x)
+{
+	store->setValue(detect_moves_key, x);
+}
+
 std::vector< FileNameMatcher::match_descriptor > MySettings::getMatchRules() const
 {
 	std::vector< FileNameMatcher::match_descriptor > v;
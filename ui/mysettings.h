@@ -35,6 +35,7 @@ class QString;
 class QSettings;
 class QRegExp;
 #include <QMap>
+#include <QStringList>
 
 #include "filenamematcher.h"
 
@@ -53,6 +54,68 @@ public:
 	int getFileSizeCompareLimit() const;
 	void setFileSizeCompareLimit(int);
 
+	/** Number of threads used to compare files. 0 means one per core
+	 */
+	int getCompareThreads() const;
+	void setCompareThreads(int);
+
+	/** Number of comparisons that may wait in the queue, per thread
+	 */
+	int getCompareQueueDepth() const;
+	void setCompareQueueDepth(int);
+
+	/** Whether to remember the hashes of files that have been compared
+	 */
+	bool getHashCache() const;
+	void setHashCache(bool);
+
+	/** Whether to check the start, end and a few blocks in the middle of
+	 * large files before reading them in full
+	 */
+	bool getSampledCompare() const;
+	void setSampledCompare(bool);
+
+	/** Whether to read files in the background, several blocks ahead of the
+	 * comparison (io_uring, where available)
+	 */
+	bool getAsyncRead() const;
+	void setAsyncRead(bool);
+
+	/** Whether to save scanned directory trees, and show them straight away
+	 * the next time the same directory is opened
+	 */
+	bool getSnapshots() const;
+	void setSnapshots(bool);
+
+	/** Whether to record the size and times of files while scanning, so
+	 * files of different sizes can be told apart without opening them
+	 */
+	bool getScanMetadata() const;
+	void setScanMetadata(bool);
+
+	/** Whether to show files with the same size and modification time as
+	 * probably the same, until their contents have been compared
+	 */
+	bool getQuickCompare() const;
+	void setQuickCompare(bool);
+
+	/** Patterns for files and directories that are left out of scans, as in
+	 * a .gitignore file
+	 */
+	QStringList getIgnoreRules() const;
+	void setIgnoreRules(const QStringList&);
+
+	/** Whether to also follow the .gitignore files found when scanning
+	 */
+	bool getGitIgnore() const;
+	void setGitIgnore(bool);
+
+	/** Whether to look for files that are only on one side, but have the same
+	 * contents as a file only on the other side
+	 */
+	bool getDetectMoves() const;
+	void setDetectMoves(bool);
+
 	std::vector< FileNameMatcher::match_descriptor > getMatchRules() const;
 	void setMatchRules(const std::vector< FileNameMatcher::match_descriptor >&);
 private:
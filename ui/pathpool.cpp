@@ -0,0 +1,151 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "pathpool.h"
+
+#include <algorithm>
+
+namespace
+{
+/* Each directory in a key is written as dir_mark, its name, then end_mark.
+ * end_mark is less than any byte of a name, so a shorter name sorts first.
+ */
+const char end_mark = '\0';
+const char dir_mark = '\1';
+
+}
+
+PathPool::PathPool()
+{
+	clear();
+}
+
+void PathPool::clear()
+{
+	directory_ids.clear();
+	directories.clear();
+	name_ids.clear();
+	names.clear();
+
+	directory( std::string() );
+	name( std::string() );
+}
+
+void PathPool::swap(PathPool& other)
+{
+	// Swapping maps keeps their nodes, so the pointers to them stay good
+	directory_ids.swap(other.directory_ids);
+	directories.swap(other.directories);
+	name_ids.swap(other.name_ids);
+	names.swap(other.names);
+}
+
+std::size_t PathPool::size() const
+{
+	return directories.size() + names.size();
+}
+
+PathPool::id_type PathPool::directory(const std::string& s)
+{
+	const std::pair< index_type::iterator, bool > p = directory_ids.insert( index_type::value_type( s, static_cast< id_type >( directories.size() ) ) );
+
+	if ( p.second )
+	{
+		directory_entry d = { &p.first->first, std::string() };
+
+		for ( std::size_t i = 0; i < s.length();)
+		{
+			const std::size_t j = s.find('/', i);
+
+			d.key += dir_mark;
+			d.key.append(s, i, j - i);
+			d.key += end_mark;
+			i = j + 1;
+		}
+
+		directories.push_back(d);
+	}
+
+	return p.first->second;
+}
+
+PathPool::id_type PathPool::name(const std::string& s)
+{
+	const std::pair< index_type::iterator, bool > p = name_ids.insert( index_type::value_type( s, static_cast< id_type >( names.size() ) ) );
+
+	if ( p.second )
+	{
+		names.push_back(&p.first->first);
+	}
+
+	return p.first->second;
+}
+
+const std::string& PathPool::prefix(id_type d) const
+{
+	return *directories[d].prefix;
+}
+
+const std::string& PathPool::str(id_type n) const
+{
+	return *names[n];
+}
+
+std::string PathPool::path(
+	id_type d,
+	id_type n
+) const
+{
+	return n == 0 ? std::string() : prefix(d) + str(n);
+}
+
+bool PathPool::less(
+	id_type ld,
+	id_type ln,
+	id_type rd,
+	id_type rn
+) const
+{
+	if ( ld == rd )
+	{
+		return str(ln) < str(rn);
+	}
+
+	const std::string& l = directories[ld].key;
+	const std::string& r = directories[rd].key;
+	const std::size_t  n = std::min( l.length(), r.length() );
+	const int          c = l.compare(0, n, r, 0, n);
+
+	if ( c != 0 )
+	{
+		return c < 0;
+	}
+
+	// One directory is inside the other, and comes before the other's files
+	return l.length() > r.length();
+}
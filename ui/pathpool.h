@@ -0,0 +1,104 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PATHPOOL_H
+#define PATHPOOL_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+/** Stores each directory and file name of the comparison list once
+ *
+ * Rows refer to names by id, rather than holding copies of full paths. Ids
+ * stay valid until clear() is called. Id 0 is the empty string, and the top
+ * directory.
+ */
+class PathPool
+{
+public:
+	typedef unsigned id_type;
+
+	PathPool();
+
+	/** Forget all names, ex., because no rows refer to them anymore
+	 */
+	void clear();
+
+	void swap(PathPool&);
+
+	/** Number of directories and names stored
+	 */
+	std::size_t size() const;
+
+	/** Get the id of a directory
+	 * @param prefix Path of the directory, with a trailing slash, ex., "a/b/",
+	 *   or empty for the top directory
+	 */
+	id_type directory(const std::string& prefix);
+
+	/** Get the id of a file name, or any other string
+	 */
+	id_type name(const std::string&);
+
+	const std::string& prefix(id_type directory) const;
+	const std::string& str(id_type name) const;
+
+	/** Get the path of a file, or an empty string if name is 0
+	 */
+	std::string path(id_type directory, id_type name) const;
+
+	/** Whether the first file is before the second
+	 *
+	 * Paths are compared directory by directory. Files are sorted after
+	 * directories within the same directory.
+	 */
+	bool less(id_type ldirectory, id_type lname, id_type rdirectory, id_type rname) const;
+private:
+	// Entries point into the maps, so a copy would point into the original
+	PathPool(const PathPool&);
+	PathPool& operator=(const PathPool&);
+
+	typedef std::map< std::string, id_type > index_type;
+
+	struct directory_entry
+	{
+		const std::string* prefix;
+
+		/// Encodes the path so that byte order is directory order
+		std::string key;
+	};
+
+	index_type                        directory_ids;
+	std::vector< directory_entry >    directories;
+	index_type                        name_ids;
+	std::vector< const std::string* > names;
+};
+
+#endif // PATHPOOL_H
@@ -45,6 +45,17 @@ SettingsDialog::SettingsDialog(QWidget* parent)
 	ui->diffToolLineEdit->setText( settings.getDiffTool() );
 	ui->editorLineEdit->setText( settings.getEditor() );
 	ui->fileSizeCompareLimitMBSpinBox->setValue( settings.getFileSizeCompareLimit() );
+	ui->compareThreadsSpinBox->setValue( settings.getCompareThreads() );
+	ui->compareQueueDepthSpinBox->setValue( settings.getCompareQueueDepth() );
+	ui->hashCacheCheckBox->setChecked( settings.getHashCache() );
+	ui->sampledCompareCheckBox->setChecked( settings.getSampledCompare() );
+	ui->asyncReadCheckBox->setChecked( settings.getAsyncRead() );
+	ui->snapshotsCheckBox->setChecked( settings.getSnapshots() );
+	ui->scanMetadataCheckBox->setChecked( settings.getScanMetadata() );
+	ui->quickCompareCheckBox->setChecked( settings.getQuickCompare() );
+	ui->ignoreRulesEdit->setPlainText( settings.getIgnoreRules().join("\n") );
+	ui->gitIgnoreCheckBox->setChecked( settings.getGitIgnore() );
+	ui->detectMovesCheckBox->setChecked( settings.getDetectMoves() );
 
 	const QMap< QString, QString > filters = settings.getFilters();
 	int                            nrows   = 0;
@@ -84,6 +95,17 @@ void SettingsDialog::on_save_clicked()
 	settings.setDiffTool( ui->diffToolLineEdit->text() );
 	settings.setEditor( ui->editorLineEdit->text() );
 	settings.setFileSizeCompareLimit( ui->fileSizeCompareLimitMBSpinBox->value() );
+	settings.setCompareThreads( ui->compareThreadsSpinBox->value() );
+	settings.setCompareQueueDepth( ui->compareQueueDepthSpinBox->value() );
+	settings.setHashCache( ui->hashCacheCheckBox->isChecked() );
+	settings.setSampledCompare( ui->sampledCompareCheckBox->isChecked() );
+	settings.setAsyncRead( ui->asyncReadCheckBox->isChecked() );
+	settings.setSnapshots( ui->snapshotsCheckBox->isChecked() );
+	settings.setScanMetadata( ui->scanMetadataCheckBox->isChecked() );
+	settings.setQuickCompare( ui->quickCompareCheckBox->isChecked() );
+	settings.setIgnoreRules( ui->ignoreRulesEdit->toPlainText().split('\n', QString::SkipEmptyParts) );
+	settings.setGitIgnore( ui->gitIgnoreCheckBox->isChecked() );
+	settings.setDetectMoves( ui->detectMovesCheckBox->isChecked() );
 
 	QMap< QString, QString > m;
 
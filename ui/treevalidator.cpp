@@ -0,0 +1,82 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "treevalidator.h"
+
+TreeValidator::TreeValidator(
+	const DirectoryContents& left,
+	const DirectoryContents& right,
+	int                      depth_,
+	const std::string&       lsnapshot,
+	const std::string&       rsnapshot,
+	QObject*                 parent_
+)
+	: QThread(parent_), maxdepth(depth_), token( cancel_source.token() )
+{
+	trees[0]     = left;
+	trees[1]     = right;
+	snapshots[0] = lsnapshot;
+	snapshots[1] = rsnapshot;
+}
+
+void TreeValidator::cancel()
+{
+	cancel_source.cancel();
+}
+
+bool TreeValidator::cancelled() const
+{
+	return token.cancelled();
+}
+
+int TreeValidator::depth() const
+{
+	return maxdepth;
+}
+
+void TreeValidator::take(
+	DirectoryContents& left,
+	DirectoryContents& right
+)
+{
+	left.swap(trees[0]);
+	right.swap(trees[1]);
+}
+
+void TreeValidator::run()
+{
+	DirectoryContents::validate(trees[0], trees[1], maxdepth, token);
+
+	for ( std::size_t i = 0; i < 2; ++i )
+	{
+		if ( !token.cancelled() && trees[i].valid() && !snapshots[i].empty() )
+		{
+			trees[i].save(snapshots[i]);
+		}
+	}
+}
@@ -0,0 +1,78 @@
+/* Copyright (c) 2017, Pollard Banknote Limited
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without modification,
+   are permitted provided that the following conditions are met:
+
+   1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+
+   2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation and/or
+   other materials provided with the distribution.
+
+   3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software without
+   specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+   ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+   WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+   DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+   FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+   DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+   SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+   OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef TREEVALIDATOR_H
+#define TREEVALIDATOR_H
+
+#include <string>
+
+#include <QThread>
+
+#include "pbl/fileutil/directorycontents.h"
+#include "pbl/util/cancellation.h"
+
+/** Brings copies of both directory trees up to date in the background
+ *
+ * Used after trees are loaded from snapshots. Only directories whose
+ * modification time changed are read again. When done, the trees are saved
+ * back to their snapshot files, and finished() is emitted.
+ */
+class TreeValidator
+	: public QThread
+{
+	Q_OBJECT
+public:
+	/**
+	 * @param left, right Trees to validate. They are copied
+	 * @param depth How deep to scan
+	 * @param lsnapshot, rsnapshot Files to save the trees to, or empty
+	 */
+	TreeValidator(const DirectoryContents& left, const DirectoryContents& right, int depth, const std::string& lsnapshot, const std::string& rsnapshot, QObject* parent);
+
+	/** Stop early. The trees should not be used
+	 */
+	void cancel();
+
+	bool cancelled() const;
+
+	int depth() const;
+
+	/** Get the validated trees, after the thread has finished
+	 */
+	void take(DirectoryContents& left, DirectoryContents& right);
+protected:
+	void run();
+private:
+	DirectoryContents             trees[2];
+	std::string                   snapshots[2];
+	int                           maxdepth;
+	pbl::cancellation_source      cancel_source;
+	const pbl::cancellation_token token;
+};
+
+#endif // TREEVALIDATOR_H
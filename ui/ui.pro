@@ -29,6 +29,10 @@ SOURCES += main.cpp\
     filenamematcher.cpp \
     filecompare.cpp \
     comparisonlist.cpp \
+    pathpool.cpp \
+    comparescheduler.cpp \
+    treevalidator.cpp \
+    movedetector.cpp \
     editmatchruledialog.cpp
 
 HEADERS  += mainwindow.h \
@@ -40,6 +44,10 @@ HEADERS  += mainwindow.h \
     filenamematcher.h \
     filecompare.h \
     comparisonlist.h \
+    pathpool.h \
+    comparescheduler.h \
+    treevalidator.h \
+    movedetector.h \
     editmatchruledialog.h
 
 FORMS    += mainwindow.ui \